@@ -0,0 +1,224 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "acquire.h"
+#include "error.h"
+
+acquire_config_t acquire_config = {
+	.sweeps = 1,
+	.boxcar = 1,
+};
+char acquire_enabled = 0;
+
+/* Requested by the display (acquire_set_length()), applied at the next sweep */
+static uint64_t acquire_length_requested = 0;
+
+/* The feeding thread's state */
+static struct {
+	uint64_t length;		/* of a sweep, in records		*/
+	uint32_t boxcar;		/* samples per point			*/
+	uint32_t points;		/* per sweep				*/
+	uint32_t averaged;		/* sweeps in the average so far		*/
+	char     sweeping;
+	uint32_t point;			/* being accumulated			*/
+	uint32_t samples;		/* ... of it so far			*/
+	uint64_t ts_start;		/* of the sweep (the trigger event)	*/
+	uint64_t ts_sum;		/* offsets from ts_start		*/
+	acquire_ulanes_t sum;
+} acquire_state;
+
+static acquire_lanes_t acquire_mean[ACQUIRE_POINTS_MAX];
+
+/*
+ * Completed sweeps are published to acquire_read() alternately in the two
+ * buffers: sweep number "acquire_seq" is in acquire_out[acquire_seq & 1]
+ * and the next one is being written to the other buffer.
+ */
+static history_t acquire_out   [2][ACQUIRE_POINTS_MAX];
+static uint32_t  acquire_points[2];
+static uint64_t  acquire_seq = 0;
+
+/*
+ * Parses "average=<sweeps>,hires=<samples>" (either or both) and enables
+ * the acquisition. Returns 0 on success.
+ */
+int acquire_parse(char *spec) {
+	enum {
+		OPT_AVERAGE = 0,
+		OPT_HIRES,
+	};
+	char *const options[] = {
+		[OPT_AVERAGE] = "average",
+		[OPT_HIRES]   = "hires",
+		NULL
+	};
+	acquire_config_t c = acquire_config;
+	char *value;
+
+	while (*spec) {
+		int opt = getsubopt(&spec, options, &value);
+
+		if (opt >= 0 && value == NULL) {
+			error("Acquisition option \"%s\" requires a value", options[opt]);
+			return EINVAL;
+		}
+
+		switch (opt) {
+			case OPT_AVERAGE:
+				c.sweeps = atoi(value);
+				break;
+			case OPT_HIRES:
+				c.boxcar = atoi(value);
+				break;
+			default:
+				error("Unknown acquisition option \"%s\"", value);
+				return EINVAL;
+		}
+	}
+
+	if (c.sweeps < 1 || c.sweeps > ACQUIRE_SWEEPS_MAX) {
+		error("The number of averaged sweeps should be in [1; %u]", ACQUIRE_SWEEPS_MAX);
+		return EINVAL;
+	}
+
+	if (c.boxcar < 1 || c.boxcar > ACQUIRE_BOXCAR_MAX) {
+		error("The number of samples per hires point should be in [1; %u]", ACQUIRE_BOXCAR_MAX);
+		return EINVAL;
+	}
+
+	acquire_config  = c;
+	acquire_enabled = 1;
+	return 0;
+}
+
+/* Sets the sweep length; the average is restarted if it changes */
+void acquire_set_length(uint64_t records) {
+	__atomic_store_n(&acquire_length_requested, records, __ATOMIC_RELAXED);
+}
+
+static void acquire_start(const history_t *p) {
+	uint64_t length = __atomic_load_n(&acquire_length_requested, __ATOMIC_RELAXED);
+
+	if (length != acquire_state.length) {
+		uint64_t boxcar = MAX(acquire_config.boxcar, (length + ACQUIRE_POINTS_MAX - 1) / ACQUIRE_POINTS_MAX);
+
+		acquire_state.length   = length;
+		acquire_state.boxcar   = MAX(MIN(boxcar, length), 1);
+		acquire_state.points   = length / acquire_state.boxcar;
+		acquire_state.averaged = 0;
+	}
+
+	if (acquire_state.points == 0)
+		return;
+
+	acquire_state.sweeping = 1;
+	acquire_state.point    = 0;
+	acquire_state.samples  = 0;
+	acquire_state.ts_start = p->timestamp;
+	acquire_state.ts_sum   = 0;
+	acquire_state.sum      = (acquire_ulanes_t){0};
+}
+
+/* Folds the accumulated point into the average and the buffer being written */
+static void acquire_point() {
+	uint32_t         point = acquire_state.point;
+	history_t       *out   = &acquire_out[(acquire_seq + 1) & 1][point];
+	acquire_lanes_t *mean  = &acquire_mean[point];
+	acquire_lanes_t  x     = __builtin_convertvector(acquire_state.sum, acquire_lanes_t);
+	float            n     = acquire_state.samples;
+	float            w     = 1.0 / MIN(acquire_state.averaged + 1, acquire_config.sweeps);
+
+	x[ACQUIRE_LANES - 1] = acquire_state.ts_sum;
+	x /= n;
+	*mean += (x - *mean) * w;
+
+	acquire_ulanes_t q = __builtin_convertvector(*mean * (float)(1 << ACQUIRE_FRACTION_BITS) + 0.5f, acquire_ulanes_t);
+	memcpy(out->value, &q, sizeof(out->value));
+	out->timestamp = acquire_state.ts_start + (uint64_t)(*mean)[ACQUIRE_LANES - 1];
+
+	acquire_state.sum     = (acquire_ulanes_t){0};
+	acquire_state.ts_sum  = 0;
+	acquire_state.samples = 0;
+	acquire_state.point++;
+}
+
+void acquire_feed(const history_t *p, int triggered) {
+	acquire_ulanes_t v = {0};
+
+	if (!acquire_state.sweeping) {
+		// Only the averaged sweeps need to be aligned
+		if (!triggered && acquire_config.sweeps > 1)
+			return;
+		acquire_start(p);
+		if (!acquire_state.sweeping)
+			return;
+	}
+
+	memcpy(&v, p->value, sizeof(p->value));
+	acquire_state.sum    += v;
+	acquire_state.ts_sum += p->timestamp - acquire_state.ts_start;
+
+	if (++acquire_state.samples < acquire_state.boxcar)
+		return;
+
+	acquire_point();
+	if (acquire_state.point < acquire_state.points)
+		return;
+
+	// The sweep is complete, publish it
+	acquire_state.sweeping = 0;
+	acquire_state.averaged = MIN(acquire_state.averaged + 1, acquire_config.sweeps);
+	acquire_points[(acquire_seq + 1) & 1] = acquire_state.points;
+	__atomic_store_n(&acquire_seq, acquire_seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies the last completed sweep (at most ACQUIRE_POINTS_MAX records, the
+ * values are fixed-point with ACQUIRE_FRACTION_BITS) to "out". Returns the
+ * number of points, 0 if there's no consistent sweep yet.
+ */
+size_t acquire_read(history_t *out) {
+	int tries = 3;
+
+	while (tries--) {
+		uint64_t seq = __atomic_load_n(&acquire_seq, __ATOMIC_ACQUIRE);
+		size_t   points;
+
+		if (seq == 0)
+			return 0;
+
+		points = acquire_points[seq & 1];
+		memcpy(out, acquire_out[seq & 1], points * sizeof(*out));
+
+		// The writer moves on to this buffer as soon as the next sweep is published
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&acquire_seq, __ATOMIC_RELAXED) == seq)
+			return points;
+	}
+
+	return 0;
+}
@@ -0,0 +1,68 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_ACQUIRE_H
+#define __VOLTLOGGER_ACQUIRE_H
+
+#include <stddef.h>	/* size_t	*/
+#include <stdint.h>
+
+#include "history.h"
+
+/*
+ * Averaging and high-resolution acquisition: acquire_feed() is called once
+ * per ingested record (by a single thread). From every trigger event it
+ * takes a sweep of the displayed length, boxcar-averages each "hires"
+ * consecutive samples into one point and folds the points into an
+ * exponential moving average with the weight 1/"average" (a plain mean
+ * until that many sweeps are in), so older sweeps fade out instead of
+ * leaving a window. Without averaging the sweeps are free-running: each
+ * starts right after the previous one, not at a trigger event. All the
+ * channels (and the timestamp offset) of a point are updated at once in a
+ * vector, so the cost is a few vector operations per sample and nothing per
+ * frame: acquire_read() only copies the last completed sweep.
+ */
+
+/* Longer sweeps are boxcar-averaged down to this many points */
+#define ACQUIRE_POINTS_MAX	4096
+#define ACQUIRE_SWEEPS_MAX	65536
+#define ACQUIRE_BOXCAR_MAX	65536
+
+/* The published values are fixed-point with this many fractional bits */
+#define ACQUIRE_FRACTION_BITS	8
+
+/* A lane per real channel, the last one is the timestamp offset */
+#define ACQUIRE_LANES		(MAX_REAL_CHANNELS + 1)
+typedef float    acquire_lanes_t  __attribute__ ((vector_size (ACQUIRE_LANES * sizeof(float))));
+typedef uint32_t acquire_ulanes_t __attribute__ ((vector_size (ACQUIRE_LANES * sizeof(uint32_t))));
+
+typedef struct {
+	uint32_t sweeps;		/* 1/weight of a sweep, 1 -- no averaging	*/
+	uint32_t boxcar;		/* samples per point, 1 -- full rate	*/
+} acquire_config_t;
+
+extern acquire_config_t acquire_config;
+extern char             acquire_enabled;
+
+extern int    acquire_parse(char *spec);
+extern void   acquire_set_length(uint64_t records);
+extern void   acquire_feed(const history_t *p, int triggered);
+extern size_t acquire_read(history_t *out);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "macros.h"
+
+#include "autoset.h"
+
+autoset_channel_t autoset_channels[MAX_REAL_CHANNELS];
+uint64_t          autoset_records      = 0;
+int               autoset_channels_num = 0;
+
+/* Returns the lower bound of the bin containing the "q" quantile */
+static uint32_t autoset_quantile(const autoset_channel_t *c, uint64_t total, double q) {
+	uint64_t sum = 0, rank = total * q;
+	int bin = 0;
+
+	while (bin < AUTOSET_BINS - 1) {
+		sum += __atomic_load_n(&c->hist[bin], __ATOMIC_RELAXED);
+		if (sum > rank)
+			break;
+		bin++;
+	}
+
+	return bin << (Y_BITS - AUTOSET_BITS);
+}
+
+static uint64_t autoset_total(const autoset_channel_t *c) {
+	uint64_t total = 0;
+	int bin = 0;
+
+	while (bin < AUTOSET_BINS)
+		total += __atomic_load_n(&c->hist[bin++], __ATOMIC_RELAXED);
+
+	return total;
+}
+
+/* Called by autoset_feed(): moves the crossing levels and ages the histograms */
+void autoset_update() {
+	char aging = !((autoset_records / AUTOSET_UPDATE_RECORDS) % AUTOSET_AGE_UPDATES);
+	int chan = 0;
+
+	while (chan < autoset_channels_num) {
+		autoset_channel_t *c = &autoset_channels[chan];
+		uint64_t total = autoset_total(c);
+		uint32_t lo    = autoset_quantile(c, total, AUTOSET_QUANTILE);
+		uint32_t hi    = autoset_quantile(c, total, 1 - AUTOSET_QUANTILE) + (1 << (Y_BITS - AUTOSET_BITS));
+
+		c->mid  = (lo + hi) / 2;
+		c->hyst = (hi - lo) / 8;
+
+		if (aging) {
+			int bin = 0;
+
+			while (bin < AUTOSET_BINS) {
+				__atomic_store_n(&c->hist[bin], c->hist[bin] / 2, __ATOMIC_RELAXED);
+				bin++;
+			}
+		}
+		chan++;
+	}
+}
+
+/* Returns 0 if there's not enough data yet */
+int autoset_get(int chan, autoset_result_t *r) {
+	const autoset_channel_t *c = &autoset_channels[chan];
+	uint64_t total = autoset_total(c);
+
+	if (chan >= autoset_channels_num || total < AUTOSET_RECORDS_MIN)
+		return 0;
+
+	r->lo     = autoset_quantile(c, total, AUTOSET_QUANTILE);
+	r->hi     = autoset_quantile(c, total, 1 - AUTOSET_QUANTILE) + (1 << (Y_BITS - AUTOSET_BITS));
+	r->mid    = (r->lo + r->hi) / 2;
+	r->period = __atomic_load_n(&c->period, __ATOMIC_RELAXED) / 256.;
+	return 1;
+}
@@ -0,0 +1,95 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_AUTOSET_H
+#define __VOLTLOGGER_AUTOSET_H
+
+#include <stdint.h>
+
+#include "history.h"
+
+/*
+ * Streaming statistics for the autoset: autoset_feed() is called once per
+ * ingested record (by a single thread) and keeps a coarse value histogram
+ * per channel, aged by halving, and the period (in records) between the
+ * rising crossings of the middle level. The autoset reads only these, so
+ * it's instant whatever the history size.
+ */
+
+#define AUTOSET_BITS		6		/* histogram of 2^AUTOSET_BITS bins */
+#define AUTOSET_BINS		(1 << AUTOSET_BITS)
+#define AUTOSET_UPDATE_RECORDS	4096		/* the levels are updated every ..., a power of 2 */
+#define AUTOSET_AGE_UPDATES	16		/* the histograms are halved every ... updates */
+#define AUTOSET_RECORDS_MIN	1024		/* to have an opinion */
+#define AUTOSET_QUANTILE	0.01		/* of outliers ignored at each end */
+#define AUTOSET_SCREEN_FRACTION	0.8		/* of the screen height a channel is fitted to */
+#define AUTOSET_PERIODS		4		/* on the screen */
+
+typedef struct {
+	uint32_t hist[AUTOSET_BINS];
+	uint32_t mid;				/* the crossing level and its hysteresis */
+	uint32_t hyst;
+	char     high;
+	uint64_t rise_last;			/* record number of the last rising crossing */
+	uint64_t period;			/* in records, << 8, 0 if unknown */
+} autoset_channel_t;
+
+typedef struct {
+	uint32_t lo;				/* AUTOSET_QUANTILE quantiles */
+	uint32_t hi;
+	uint32_t mid;
+	double   period;			/* in records, 0 if unknown */
+} autoset_result_t;
+
+extern autoset_channel_t autoset_channels[MAX_REAL_CHANNELS];
+extern uint64_t          autoset_records;
+extern int               autoset_channels_num;
+
+extern void autoset_update();
+extern int  autoset_get(int chan, autoset_result_t *r);
+
+static inline void autoset_feed(const history_t *p) {
+	uint64_t records = ++autoset_records;
+	int chan = 0;
+
+	while (chan < autoset_channels_num) {
+		autoset_channel_t *c = &autoset_channels[chan];
+		uint32_t v = MIN(p->value[chan], (1 << Y_BITS) - 1);
+		uint32_t *bin = &c->hist[v >> (Y_BITS - AUTOSET_BITS)];
+
+		__atomic_store_n(bin, *bin + 1, __ATOMIC_RELAXED);
+
+		if (!c->high && v >= c->mid + c->hyst) {
+			c->high = 1;
+			if (c->rise_last) {
+				uint64_t period = (records - c->rise_last) << 8;
+				__atomic_store_n(&c->period, c->period ? c->period - c->period / 8 + period / 8 : period, __ATOMIC_RELAXED);
+			}
+			c->rise_last = records;
+		} else if (c->high && v + c->hyst < c->mid) {
+			c->high = 0;
+		}
+		chan++;
+	}
+
+	if (unlikely(!(records & (AUTOSET_UPDATE_RECORDS - 1))))
+		autoset_update();
+}
+
+#endif
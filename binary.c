@@ -50,3 +50,23 @@ DECLARE_GET_X_t(uint32);
 DECLARE_GET_X_t(uint16);
 DECLARE_GET_X_t(uint8);
 
+/* Reads exactly "size" bytes waiting for the writer on EOF (like get_*()) */
+size_t get_buf(FILE *i_f, void *buf, size_t size) {
+	size_t filled = 0;
+
+	while (1) {
+		filled += fread(&((char *)buf)[filled], 1, size - filled, i_f);
+		if (filled == size)
+			break;
+
+		if (!feof(i_f)) {
+			assert (ferror(i_f));
+			break;
+		}
+
+		usleep(AUTOUPDATE_USECS);
+		clearerr(i_f);
+	}
+
+	return filled;
+}
@@ -24,4 +24,4 @@ extern uint64_t get_uint64(FILE *i_f);
 extern uint32_t get_uint32(FILE *i_f);
 extern uint16_t get_uint16(FILE *i_f);
 extern uint8_t  get_uint8(FILE *i_f);
-
+extern size_t   get_buf(FILE *i_f, void *buf, size_t size);
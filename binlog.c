@@ -0,0 +1,302 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "macros.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "binlog.h"
+#include "error.h"
+
+/*
+ * Parses a record layout "ts_device=<bytes>,value=<bytes>,endian=le|be"
+ * (omitted options are left as is). Returns 0 on success.
+ */
+int binlog_layout_parse(char *spec, binlog_layout_t *layout) {
+	enum {
+		OPT_TS_DEVICE = 0,
+		OPT_VALUE,
+		OPT_ENDIAN,
+	};
+	char *const options[] = {
+		[OPT_TS_DEVICE] = "ts_device",
+		[OPT_VALUE]     = "value",
+		[OPT_ENDIAN]    = "endian",
+		NULL
+	};
+	binlog_layout_t l = *layout;
+	char *value;
+
+	while (*spec) {
+		int opt = getsubopt(&spec, options, &value);
+
+		if (opt >= 0 && value == NULL) {
+			error("Layout option \"%s\" requires a value", options[opt]);
+			return EINVAL;
+		}
+
+		switch (opt) {
+			case OPT_TS_DEVICE:
+				l.ts_device_size = atoi(value);
+				break;
+			case OPT_VALUE:
+				l.value_size     = atoi(value);
+				break;
+			case OPT_ENDIAN:
+				if (!strcmp(value, "le"))
+					l.big_endian = 0;
+				else if (!strcmp(value, "be"))
+					l.big_endian = 1;
+				else {
+					error("Unknown endianness \"%s\"", value);
+					return EINVAL;
+				}
+				break;
+			default:
+				error("Unknown layout option \"%s\"", value);
+				return EINVAL;
+		}
+	}
+
+	if (l.ts_device_size != 2 && l.ts_device_size != 4 && l.ts_device_size != 8) {
+		error("ts_device should be 2, 4 or 8 bytes");
+		return EINVAL;
+	}
+
+	if (l.value_size != 1 && l.value_size != 2 && l.value_size != 4) {
+		error("Values should be 1, 2 or 4 bytes");
+		return EINVAL;
+	}
+
+	*layout = l;
+	return 0;
+}
+
+/*
+ * Returns the offset of the first record boundary in "buf" or -1 if there's
+ * none. A boundary is accepted if BINLOG_SYNC_RECORDS consecutive records
+ * (or all the records up to the end of the buffer) have a plausible ts_parse.
+ */
+ssize_t binlog_find_record(const char *buf, size_t len, const binlog_layout_t *layout) {
+	size_t recsize = binlog_record_size(layout);
+	size_t offset  = 0;
+
+	while (offset + sizeof(uint64_t) <= len) {
+		int i = 0;
+
+		while (i < BINLOG_SYNC_RECORDS) {
+			size_t pos = offset + i*recsize;
+
+			if (pos + sizeof(uint64_t) > len)
+				break;
+
+			if (!binlog_ts_parse_plausible(binlog_load_field(&buf[pos], sizeof(uint64_t), layout->big_endian)))
+				break;
+
+			i++;
+		}
+
+		if (i == BINLOG_SYNC_RECORDS || offset + i*recsize + sizeof(uint64_t) > len) {
+			if (i > 0)
+				return offset;
+		}
+
+		offset++;
+	}
+
+	return -1;
+}
+
+/*
+ * Decodes all the records starting in [from; to) of a mapped binlog of
+ * "size" bytes. The first record is looked up with binlog_find_record(),
+ * after that an implausible ts_parse skips a byte. "out" (and
+ * "ts_parse_out" if not NULL) should have room for binlog_range_capacity()
+ * records. A narrow ts_device is stored as is, see binlog_unwrap().
+ *
+ * With "stride" > 1 only every stride-th record is decoded, the ones in
+ * between are jumped over (and aren't checked); "range->next" is then
+ * where the next record to decode starts, possibly beyond "size".
+ *
+ * It's always inlined with a constant layout into the generated
+ * binlog_decode_range_*() below, so the per-record loop has no variable
+ * bounds and no per-field branching.
+ */
+static inline __attribute__((always_inline)) size_t binlog_decode_range_generic(const char *map, size_t size, size_t from, size_t to, const binlog_layout_t *layout, size_t stride, const int channels, const int ts_size, const int value_size, const int big_endian, history_t *out, uint64_t *ts_parse_out, binlog_range_t *range) {
+	const size_t recsize = sizeof(uint64_t) + ts_size + channels*value_size;
+	const size_t step    = recsize * stride;
+	size_t records = 0;
+	size_t pos;
+	ssize_t found;
+
+	range->skipped = 0;
+
+	if (to > size)
+		to = size;
+
+	found = (from < to) ? binlog_find_record(&map[from], size - from, layout) : -1;
+	if (found < 0 || from + found >= to) {
+		range->first   = to;
+		range->next    = to;
+		range->records = 0;
+		return 0;
+	}
+
+	pos = from + found;
+	range->first = pos;
+
+	while (pos < to && pos + recsize <= size) {
+		uint64_t ts_parse = binlog_load_field(&map[pos], sizeof(uint64_t), big_endian);
+		int chan;
+
+		if (unlikely(!binlog_ts_parse_plausible(ts_parse))) {
+			range->skipped++;
+			pos++;
+			continue;
+		}
+
+		history_t *p = &out[records];
+		p->timestamp = binlog_load_field(&map[pos + sizeof(uint64_t)], ts_size, big_endian);
+		chan = 0;
+		while (chan < channels) {
+			p->value[chan] = binlog_load_field(&map[pos + sizeof(uint64_t) + ts_size + chan*value_size], value_size, big_endian);
+			chan++;
+		}
+
+		if (ts_parse_out != NULL)
+			ts_parse_out[records] = ts_parse;
+
+		records++;
+		pos += step;
+	}
+
+	range->next    = pos;
+	range->records = records;
+	return records;
+}
+
+typedef size_t (*binlog_decode_range_t)(const char *map, size_t size, size_t from, size_t to, const binlog_layout_t *layout, size_t stride, history_t *out, uint64_t *ts_parse_out, binlog_range_t *range);
+
+#define DECLARE_BINLOG_DECODE_RANGE(N, TS, V, BE)	\
+	static size_t binlog_decode_range_ ## N ## _ ## TS ## _ ## V ## _ ## BE (const char *map, size_t size, size_t from, size_t to, const binlog_layout_t *layout, size_t stride, history_t *out, uint64_t *ts_parse_out, binlog_range_t *range) {\
+		return binlog_decode_range_generic(map, size, from, to, layout, stride, N, TS, V, BE, out, ts_parse_out, range);\
+	}
+
+#if MAX_REAL_CHANNELS != 7
+	#error Update DECLARE_BINLOG_DECODE_RANGES() and BINLOG_DECODE_RANGES() to MAX_REAL_CHANNELS
+#endif
+
+#define DECLARE_BINLOG_DECODE_RANGES(TS, V, BE)	\
+	DECLARE_BINLOG_DECODE_RANGE(1, TS, V, BE)	\
+	DECLARE_BINLOG_DECODE_RANGE(2, TS, V, BE)	\
+	DECLARE_BINLOG_DECODE_RANGE(3, TS, V, BE)	\
+	DECLARE_BINLOG_DECODE_RANGE(4, TS, V, BE)	\
+	DECLARE_BINLOG_DECODE_RANGE(5, TS, V, BE)	\
+	DECLARE_BINLOG_DECODE_RANGE(6, TS, V, BE)	\
+	DECLARE_BINLOG_DECODE_RANGE(7, TS, V, BE)
+
+#define BINLOG_DECODE_RANGES(TS, V, BE) {		\
+		NULL,					\
+		binlog_decode_range_1_ ## TS ## _ ## V ## _ ## BE,	\
+		binlog_decode_range_2_ ## TS ## _ ## V ## _ ## BE,	\
+		binlog_decode_range_3_ ## TS ## _ ## V ## _ ## BE,	\
+		binlog_decode_range_4_ ## TS ## _ ## V ## _ ## BE,	\
+		binlog_decode_range_5_ ## TS ## _ ## V ## _ ## BE,	\
+		binlog_decode_range_6_ ## TS ## _ ## V ## _ ## BE,	\
+		binlog_decode_range_7_ ## TS ## _ ## V ## _ ## BE,	\
+	}
+
+DECLARE_BINLOG_DECODE_RANGES(2, 1, 0)
+DECLARE_BINLOG_DECODE_RANGES(2, 2, 0)
+DECLARE_BINLOG_DECODE_RANGES(2, 4, 0)
+DECLARE_BINLOG_DECODE_RANGES(4, 1, 0)
+DECLARE_BINLOG_DECODE_RANGES(4, 2, 0)
+DECLARE_BINLOG_DECODE_RANGES(4, 4, 0)
+DECLARE_BINLOG_DECODE_RANGES(8, 1, 0)
+DECLARE_BINLOG_DECODE_RANGES(8, 2, 0)
+DECLARE_BINLOG_DECODE_RANGES(8, 4, 0)
+DECLARE_BINLOG_DECODE_RANGES(2, 1, 1)
+DECLARE_BINLOG_DECODE_RANGES(2, 2, 1)
+DECLARE_BINLOG_DECODE_RANGES(2, 4, 1)
+DECLARE_BINLOG_DECODE_RANGES(4, 1, 1)
+DECLARE_BINLOG_DECODE_RANGES(4, 2, 1)
+DECLARE_BINLOG_DECODE_RANGES(4, 4, 1)
+DECLARE_BINLOG_DECODE_RANGES(8, 1, 1)
+DECLARE_BINLOG_DECODE_RANGES(8, 2, 1)
+DECLARE_BINLOG_DECODE_RANGES(8, 4, 1)
+
+/* [big_endian][log2(ts_device_size) - 1][log2(value_size)][channels] */
+static const binlog_decode_range_t binlog_decode_range_kernels[2][3][3][MAX_REAL_CHANNELS + 1] = {
+	{
+		{ BINLOG_DECODE_RANGES(2, 1, 0), BINLOG_DECODE_RANGES(2, 2, 0), BINLOG_DECODE_RANGES(2, 4, 0) },
+		{ BINLOG_DECODE_RANGES(4, 1, 0), BINLOG_DECODE_RANGES(4, 2, 0), BINLOG_DECODE_RANGES(4, 4, 0) },
+		{ BINLOG_DECODE_RANGES(8, 1, 0), BINLOG_DECODE_RANGES(8, 2, 0), BINLOG_DECODE_RANGES(8, 4, 0) },
+	},
+	{
+		{ BINLOG_DECODE_RANGES(2, 1, 1), BINLOG_DECODE_RANGES(2, 2, 1), BINLOG_DECODE_RANGES(2, 4, 1) },
+		{ BINLOG_DECODE_RANGES(4, 1, 1), BINLOG_DECODE_RANGES(4, 2, 1), BINLOG_DECODE_RANGES(4, 4, 1) },
+		{ BINLOG_DECODE_RANGES(8, 1, 1), BINLOG_DECODE_RANGES(8, 2, 1), BINLOG_DECODE_RANGES(8, 4, 1) },
+	},
+};
+
+static inline binlog_decode_range_t binlog_decode_range_kernel(const binlog_layout_t *layout) {
+	return binlog_decode_range_kernels
+		[!!layout->big_endian]
+		[__builtin_ctz(layout->ts_device_size) - 1]
+		[__builtin_ctz(layout->value_size)]
+		[layout->channels];
+}
+
+size_t binlog_decode_range(const char *map, size_t size, size_t from, size_t to, const binlog_layout_t *layout, history_t *out, uint64_t *ts_parse_out, binlog_range_t *range) {
+	return binlog_decode_range_kernel(layout)(map, size, from, to, layout, 1, out, ts_parse_out, range);
+}
+
+/* Decodes every "stride"-th record, see binlog_decode_range_generic() */
+size_t binlog_decode_strided(const char *map, size_t size, size_t from, size_t to, const binlog_layout_t *layout, size_t stride, history_t *out, uint64_t *ts_parse_out, binlog_range_t *range) {
+	return binlog_decode_range_kernel(layout)(map, size, from, to, layout, stride, out, ts_parse_out, range);
+}
+
+/*
+ * Extends a narrow ts_device of consecutive records to 64 bits: a value less
+ * than the previous one means the counter wrapped around. Should be called
+ * on the records in the order of the stream.
+ */
+void binlog_unwrap(const binlog_layout_t *layout, binlog_unwrap_t *state, history_t *rows, size_t count) {
+	const uint64_t mask = layout->ts_device_size < 8 ? ((uint64_t)1 << (layout->ts_device_size * 8)) - 1 : ~(uint64_t)0;
+	uint64_t last = state->last;
+	size_t i = 0;
+
+	if (layout->ts_device_size >= 8)
+		return;
+
+	while (i < count) {
+		uint64_t ts = (last & ~mask) | rows[i].timestamp;
+
+		if (rows[i].timestamp < (last & mask))
+			ts += mask + 1;
+
+		rows[i].timestamp = last = ts;
+		i++;
+	}
+
+	state->last = last;
+}
@@ -0,0 +1,125 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_BINLOG_H
+#define __VOLTLOGGER_BINLOG_H
+
+#include <stdint.h>	/* uint64_t	*/
+#include <string.h>	/* memcpy()	*/
+#include <sys/types.h>	/* ssize_t	*/
+
+#include "history.h"
+
+/*
+ * Legacy binlog record (as written by voltlogger_parser -b):
+ *
+ *	uint64_t ts_parse;
+ *	uint64_t ts_device;
+ *	uint32_t value[channels];
+ *
+ * There're no markers, so record boundaries are recognized by a plausible
+ * ts_parse value.
+ *
+ * Other loggers write narrower fields, so the layout is described by
+ * binlog_layout_t (see binlog_layout_parse()): ts_device of 2, 4 or 8
+ * bytes (narrow counters are unwrapped by binlog_unwrap()), values of 1,
+ * 2 or 4 bytes, little or big endian. ts_parse is always 64-bit as it's
+ * the only sync marker. A decoder is generated for every layout (see
+ * binlog.c), so the per-record loop has no per-field branching.
+ */
+
+typedef struct {
+	int channels;
+	int ts_device_size;
+	int value_size;
+	int big_endian;
+} binlog_layout_t;
+
+#define BINLOG_LAYOUT_LEGACY(channels) ((binlog_layout_t){channels, sizeof(uint64_t), sizeof(uint32_t), 0})
+
+/* State of unwrapping of a narrow ts_device */
+typedef struct {
+	uint64_t last;
+} binlog_unwrap_t;
+
+#define BINLOG_TS_PARSE_MIN	1437900000000000000ULL
+#define BINLOG_TS_PARSE_MAX	1537900000000000000ULL
+
+/* How many consecutive plausible records are required to accept a boundary */
+#define BINLOG_SYNC_RECORDS	3
+
+static inline size_t binlog_record_size(const binlog_layout_t *layout) {
+	return sizeof(uint64_t) + layout->ts_device_size + layout->channels * layout->value_size;
+}
+
+static inline int binlog_ts_parse_plausible(uint64_t ts_parse) {
+	return ts_parse >= BINLOG_TS_PARSE_MIN && ts_parse <= BINLOG_TS_PARSE_MAX;
+}
+
+static inline uint64_t binlog_load_uint64(const char *p) {
+	uint64_t r;
+	memcpy(&r, p, sizeof(r));
+	return r;
+}
+
+static inline uint32_t binlog_load_uint32(const char *p) {
+	uint32_t r;
+	memcpy(&r, p, sizeof(r));
+	return r;
+}
+
+/* Loads a field of "size" bytes; folds into a single load (and bswap) for constant arguments */
+static inline __attribute__((always_inline)) uint64_t binlog_load_field(const char *p, const int size, const int big_endian) {
+	uint16_t r16;
+	uint32_t r32;
+	uint64_t r64;
+
+	switch (size) {
+		case 1:
+			return *(const uint8_t *)p;
+		case 2:
+			memcpy(&r16, p, sizeof(r16));
+			return big_endian ? __builtin_bswap16(r16) : r16;
+		case 4:
+			memcpy(&r32, p, sizeof(r32));
+			return big_endian ? __builtin_bswap32(r32) : r32;
+		default:
+			memcpy(&r64, p, sizeof(r64));
+			return big_endian ? __builtin_bswap64(r64) : r64;
+	}
+}
+
+typedef struct {
+	size_t first;		/* offset of the first decoded record		*/
+	size_t next;		/* offset right after the last decoded record	*/
+	size_t skipped;		/* bytes skipped after the first record		*/
+	size_t records;
+} binlog_range_t;
+
+static inline size_t binlog_range_capacity(size_t from, size_t to, const binlog_layout_t *layout) {
+	return (to - from) / binlog_record_size(layout) + 1;
+}
+
+extern int     binlog_layout_parse(char *spec, binlog_layout_t *layout);
+extern ssize_t binlog_find_record(const char *buf, size_t len, const binlog_layout_t *layout);
+extern size_t  binlog_decode_range(const char *map, size_t size, size_t from, size_t to, const binlog_layout_t *layout, history_t *out, uint64_t *ts_parse_out, binlog_range_t *range);
+extern size_t  binlog_decode_strided(const char *map, size_t size, size_t from, size_t to, const binlog_layout_t *layout, size_t stride, history_t *out, uint64_t *ts_parse_out, binlog_range_t *range);
+extern void    binlog_unwrap(const binlog_layout_t *layout, binlog_unwrap_t *state, history_t *rows, size_t count);
+
+#endif
@@ -0,0 +1,432 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Converts a legacy binlog into a chunked per-channel columnar file and reads
+ * such files back. The binlog is mapped and split into chunks which are
+ * decoded by all the cores, while the calling thread writes finished chunks
+ * in order.
+ */
+
+#include "macros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "columnar.h"
+#include "binlog.h"
+#include "malloc.h"
+#include "error.h"
+#include "pthreadex.h"
+
+/* How many chunks may be decoded ahead of the writer, per thread */
+#define COLUMNAR_WINDOW_PER_THREAD	2
+
+struct columnar_chunk_state {
+	char		 done;
+	history_t	*rows;
+	uint64_t	*ts_parse;
+	binlog_range_t	 range;
+};
+
+struct columnar_job {
+	const char	*map;
+	size_t		 size;
+	size_t		 chunk_bytes;
+	const binlog_layout_t *layout;
+
+	uint64_t	 chunks;
+	uint64_t	 next;
+	uint64_t	 written;
+	uint64_t	 window;
+	struct columnar_chunk_state *state;
+
+	pthread_mutex_t	 mutex;
+	pthread_cond_t	 cond;
+};
+
+/* Lock sites of the job mutex; a cond wait counts into the hold time */
+static pthread_lockstat_t columnar_take_lockstat    = PTHREAD_LOCKSTAT_INITIALIZER("columnar_take");
+static pthread_lockstat_t columnar_done_lockstat    = PTHREAD_LOCKSTAT_INITIALIZER("columnar_done");
+static pthread_lockstat_t columnar_wait_lockstat    = PTHREAD_LOCKSTAT_INITIALIZER("columnar_wait");
+static pthread_lockstat_t columnar_written_lockstat = PTHREAD_LOCKSTAT_INITIALIZER("columnar_written");
+
+static void *columnar_worker(void *arg) {
+	struct columnar_job *job = arg;
+
+	while (1) {
+		uint64_t k;
+
+		pthread_mutex_lock_stat(&job->mutex, &columnar_take_lockstat);
+		while (job->next < job->chunks && job->next >= job->written + job->window)
+			pthread_cond_wait(&job->cond, &job->mutex);
+
+		if (job->next >= job->chunks) {
+			pthread_mutex_unlock_stat(&job->mutex, &columnar_take_lockstat);
+			break;
+		}
+		k = job->next++;
+		pthread_mutex_unlock_stat(&job->mutex, &columnar_take_lockstat);
+
+		struct columnar_chunk_state *chunk = &job->state[k];
+		size_t from = k * job->chunk_bytes;
+		size_t to   = MIN(from + job->chunk_bytes, job->size);
+		size_t cap  = binlog_range_capacity(from, to, job->layout);
+
+		chunk->rows     = xmalloc(cap * sizeof(*chunk->rows));
+		chunk->ts_parse = xmalloc(cap * sizeof(*chunk->ts_parse));
+		binlog_decode_range(job->map, job->size, from, to, job->layout, chunk->rows, chunk->ts_parse, &chunk->range);
+
+		pthread_mutex_lock_stat(&job->mutex, &columnar_done_lockstat);
+		chunk->done = 1;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock_stat(&job->mutex, &columnar_done_lockstat);
+	}
+
+	return NULL;
+}
+
+static int columnar_write_chunk(FILE *out, struct columnar_chunk_state *chunk, int channels, columnar_chunk_t *meta, void *buf) {
+	size_t records = chunk->range.records;
+	size_t r;
+	int chan;
+
+	memset(meta, 0, sizeof(*meta));
+	meta->offset  = ftello(out);
+	meta->records = records;
+
+	if (!records)
+		return 0;
+
+	meta->ts_min         = chunk->rows[0].timestamp;
+	meta->ts_max         = chunk->rows[0].timestamp;
+	meta->ts_parse_first = chunk->ts_parse[0];
+	meta->ts_parse_last  = chunk->ts_parse[records-1];
+
+	if (fwrite(chunk->ts_parse, sizeof(uint64_t), records, out) != records)
+		return -1;
+
+	uint64_t *ts = buf;
+	r = 0;
+	while (r < records) {
+		ts[r] = chunk->rows[r].timestamp;
+		meta->ts_min = MIN(meta->ts_min, ts[r]);
+		meta->ts_max = MAX(meta->ts_max, ts[r]);
+		r++;
+	}
+	if (fwrite(ts, sizeof(uint64_t), records, out) != records)
+		return -1;
+
+	chan = 0;
+	while (chan < channels) {
+		uint32_t *column = buf;
+		uint32_t  min = UINT32_MAX, max = 0;
+
+		r = 0;
+		while (r < records) {
+			uint32_t value = chunk->rows[r].value[chan];
+			column[r] = value;
+			min = MIN(min, value);
+			max = MAX(max, value);
+			r++;
+		}
+		meta->value_min[chan] = min;
+		meta->value_max[chan] = max;
+
+		if (fwrite(column, sizeof(uint32_t), records, out) != records)
+			return -1;
+		chan++;
+	}
+
+	return 0;
+}
+
+int columnar_convert(const char *binlogpath, const char *outpath, const binlog_layout_t *layout, int threads) {
+	const int channels = layout->channels;
+	binlog_unwrap_t unwrap = { 0 };
+	struct columnar_job job;
+	struct stat st;
+	columnar_header_t header;
+	columnar_chunk_t *index;
+	pthread_t *thread;
+	FILE *out;
+	void *buf;
+	int fd, rc = 0;
+	uint64_t k;
+
+	fd = open(binlogpath, O_RDONLY);
+	if (fd == -1) {
+		error("Cannot open file \"%s\"", binlogpath);
+		return -1;
+	}
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		error("\"%s\" is not a non-empty regular file", binlogpath);
+		close(fd);
+		return -1;
+	}
+
+	out = fopen(outpath, "w");
+	if (out == NULL) {
+		error("Cannot open file \"%s\"", outpath);
+		close(fd);
+		return -1;
+	}
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+
+	memset(&job, 0, sizeof(job));
+	job.size        = st.st_size;
+	job.layout      = layout;
+	job.chunk_bytes = COLUMNAR_CHUNK_RECORDS * binlog_record_size(layout);
+	job.chunks      = (job.size + job.chunk_bytes - 1) / job.chunk_bytes;
+	job.window      = threads * COLUMNAR_WINDOW_PER_THREAD;
+	job.map         = mmap(NULL, job.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (job.map == MAP_FAILED) {
+		error("Cannot mmap() file \"%s\"", binlogpath);
+		fclose(out);
+		return -1;
+	}
+	madvise((void *)job.map, job.size, MADV_SEQUENTIAL);
+
+	job.state = xcalloc(job.chunks, sizeof(*job.state));
+	index     = xcalloc(job.chunks, sizeof(*index));
+	thread    = xcalloc(threads, sizeof(*thread));
+	buf       = xmalloc(binlog_range_capacity(0, job.chunk_bytes, layout) * sizeof(uint64_t));
+	pthread_mutex_init(&job.mutex, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+	header.version  = COLUMNAR_VERSION;
+	header.channels = channels;
+	header.chunks   = job.chunks;
+	header.ts_min   = UINT64_MAX;
+	if (fwrite(&header, sizeof(header), 1, out) != 1)
+		rc = -1;
+
+	int i = 0;
+	while (i < threads) {
+		if (pthread_create(&thread[i], NULL, columnar_worker, &job))
+			critical("Cannot create a thread");
+		i++;
+	}
+
+	size_t skipped = 0;
+	size_t expected = 0;
+	k = 0;
+	while (k < job.chunks) {
+		struct columnar_chunk_state *chunk = &job.state[k];
+
+		pthread_mutex_lock_stat(&job.mutex, &columnar_wait_lockstat);
+		while (!chunk->done)
+			pthread_cond_wait(&job.cond, &job.mutex);
+		pthread_mutex_unlock_stat(&job.mutex, &columnar_wait_lockstat);
+
+		// A boundary found inside the previous chunk's last record: decode again from its end
+		if (chunk->range.records && chunk->range.first < expected) {
+			warning("Chunk %lu starts at %lu, but the previous one ends at %lu", k, chunk->range.first, expected);
+			binlog_decode_range(job.map, job.size, expected, MIN((k + 1) * job.chunk_bytes, job.size), layout, chunk->rows, chunk->ts_parse, &chunk->range);
+		}
+
+		if (chunk->range.records) {
+			skipped += chunk->range.first - expected;
+			expected = chunk->range.next;
+		}
+
+		// Narrow timestamps can only be unwrapped in order
+		binlog_unwrap(layout, &unwrap, chunk->rows, chunk->range.records);
+
+		if (!rc && columnar_write_chunk(out, chunk, channels, &index[k], buf))
+			rc = -1;
+
+		header.records += index[k].records;
+		if (index[k].records) {
+			header.ts_min = MIN(header.ts_min, index[k].ts_min);
+			header.ts_max = MAX(header.ts_max, index[k].ts_max);
+		}
+		skipped += chunk->range.skipped;
+
+		free(chunk->rows);
+		free(chunk->ts_parse);
+
+		pthread_mutex_lock_stat(&job.mutex, &columnar_written_lockstat);
+		job.written++;
+		pthread_cond_broadcast(&job.cond);
+		pthread_mutex_unlock_stat(&job.mutex, &columnar_written_lockstat);
+		k++;
+	}
+
+	i = 0;
+	while (i < threads)
+		pthread_join(thread[i++], NULL);
+
+	header.index_offset = ftello(out);
+	if (!rc && fwrite(index, sizeof(*index), job.chunks, out) != job.chunks)
+		rc = -1;
+	if (!rc && (fseeko(out, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, out) != 1))
+		rc = -1;
+	if (fclose(out))
+		rc = -1;
+	if (rc)
+		error("Cannot write file \"%s\"", outpath);
+	else
+		info("Converted %lu records in %lu chunks (%lu bytes skipped)", header.records, header.chunks, skipped);
+
+	pthread_cond_destroy(&job.cond);
+	pthread_mutex_destroy(&job.mutex);
+	munmap((void *)job.map, job.size);
+	free(buf);
+	free(thread);
+	free(index);
+	free(job.state);
+	return rc;
+}
+
+static int columnar_read_header(FILE *in, columnar_header_t *header) {
+	if (fread(header, sizeof(*header), 1, in) != 1)
+		return -1;
+
+	if (memcmp(header->magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)))
+		return -1;
+
+	if (header->version != COLUMNAR_VERSION || header->channels < 1 || header->channels > MAX_REAL_CHANNELS)
+		return -1;
+
+	return 0;
+}
+
+int columnar_probe(const char *path) {
+	columnar_header_t header;
+	FILE *in;
+	int rc;
+
+	in = fopen(path, "r");
+	if (in == NULL)
+		return 0;
+
+	rc = !columnar_read_header(in, &header);
+	fclose(in);
+	return rc;
+}
+
+/*
+ * Loads up to "max_records" last records into "history". Only the chunks
+ * covering the tail are read, so it doesn't depend on the file size.
+ */
+ssize_t columnar_load_tail(const char *path, history_t *history, size_t max_records, int *channels_p) {
+	columnar_header_t header;
+	columnar_chunk_t *index;
+	uint64_t first, k;
+	size_t total = 0, loaded = 0;
+	void *buf = NULL;
+	FILE *in;
+
+	in = fopen(path, "r");
+	if (in == NULL) {
+		error("Cannot open file \"%s\"", path);
+		return -1;
+	}
+
+	if (columnar_read_header(in, &header)) {
+		error("\"%s\" is not a columnar file", path);
+		fclose(in);
+		return -1;
+	}
+
+	index = xcalloc(header.chunks, sizeof(*index));
+	if (fseeko(in, header.index_offset, SEEK_SET) || fread(index, sizeof(*index), header.chunks, in) != header.chunks) {
+		error("Cannot read the chunk index of \"%s\"", path);
+		free(index);
+		fclose(in);
+		return -1;
+	}
+
+	first = header.chunks;
+	while (first > 0 && total < max_records)
+		total += index[--first].records;
+
+	k = first;
+	while (k < header.chunks) {
+		columnar_chunk_t *meta = &index[k++];
+		size_t records = meta->records;
+		size_t skip    = 0, r;
+		int chan;
+
+		if (!records)
+			continue;
+
+		if (total > max_records) {
+			skip   = MIN(total - max_records, records);
+			total -= skip;
+		}
+
+		buf = xrealloc(buf, records * sizeof(uint64_t));
+
+		/* ts_parse is not used by the viewer */
+		if (fseeko(in, meta->offset + records * sizeof(uint64_t), SEEK_SET) ||
+		    fread(buf, sizeof(uint64_t), records, in) != records)
+			goto l_error;
+		r = skip;
+		while (r < records) {
+			history[loaded + r - skip].timestamp = ((uint64_t *)buf)[r];
+			r++;
+		}
+
+		chan = 0;
+		while (chan < header.channels) {
+			if (fread(buf, sizeof(uint32_t), records, in) != records)
+				goto l_error;
+			r = skip;
+			while (r < records) {
+				history[loaded + r - skip].value[chan] = ((uint32_t *)buf)[r];
+				r++;
+			}
+			chan++;
+		}
+
+		loaded += records - skip;
+	}
+
+	if (channels_p != NULL)
+		*channels_p = header.channels;
+
+	free(buf);
+	free(index);
+	fclose(in);
+	return loaded;
+
+l_error:
+	error("Cannot read file \"%s\"", path);
+	free(buf);
+	free(index);
+	fclose(in);
+	return -1;
+}
@@ -0,0 +1,71 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_COLUMNAR_H
+#define __VOLTLOGGER_COLUMNAR_H
+
+#include <stdint.h>	/* uint64_t	*/
+#include <sys/types.h>	/* ssize_t	*/
+
+#include "history.h"
+#include "binlog.h"
+
+/*
+ * Columnar analysis file layout:
+ *
+ *	columnar_header_t header;
+ *	chunk 0: uint64_t ts_parse[records]; uint64_t ts_device[records];
+ *	         uint32_t value[channels][records];
+ *	chunk 1: ...
+ *	columnar_chunk_t  index[header.chunks];	(at header.index_offset)
+ *
+ * All the values are stored in the host byte order (the same as binlog).
+ */
+
+#define COLUMNAR_MAGIC		"VLCOLMN"
+#define COLUMNAR_VERSION	1
+#define COLUMNAR_CHUNK_RECORDS	(1 << 16)
+
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t channels;
+	uint64_t records;
+	uint64_t chunks;
+	uint64_t index_offset;
+	uint64_t ts_min;
+	uint64_t ts_max;
+} columnar_header_t;
+
+typedef struct {
+	uint64_t offset;
+	uint64_t records;
+	uint64_t ts_min;
+	uint64_t ts_max;
+	uint64_t ts_parse_first;
+	uint64_t ts_parse_last;
+	uint32_t value_min[MAX_REAL_CHANNELS];
+	uint32_t value_max[MAX_REAL_CHANNELS];
+} columnar_chunk_t;
+
+extern int     columnar_convert(const char *binlogpath, const char *outpath, const binlog_layout_t *layout, int threads);
+extern int     columnar_probe(const char *path);
+extern ssize_t columnar_load_tail(const char *path, history_t *history, size_t max_records, int *channels_p);
+
+#endif
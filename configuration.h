@@ -24,5 +24,19 @@
 
 #define	OUTPUT_LOCK_TIMEOUT		1000
 
+#define	LOG_RING_SIZE			256
+#define	LOG_MSG_SIZE			512
+#define	LOG_FLUSH_USECS			10000
+#define	LOG_RATELIMIT_NSECS		1000000000ULL
+
 #define AUTOUPDATE_USECS		100000
+#define AUTOSET_STARTUP_POLL_MSECS	100
+
+#define RASTER_MIN_SAMPLES_PER_PX	4
+
+#define REPLAY_SLEEP_NSECS		1000000
+#define REPLAY_LAG_TOLERANCE_NSECS	100000000
 
+#define OVERLOAD_BACKLOG_HIGH		(4 << 20)
+#define OVERLOAD_BACKLOG_LOW		(256 << 10)
+#define OVERLOAD_FACTOR_DEFAULT		8
@@ -0,0 +1,65 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "draw.h"
+
+#define DECLARE_DRAW_KERNEL(N)							\
+	static void draw_kernel_ ## N (const history_t *h, size_t count, const draw_transform_t *t, float *x, float *y[MAX_REAL_CHANNELS]) {\
+		size_t i = 0;							\
+										\
+		while (i < count) {						\
+			x[i] = t->x_offset + t->x_scale * (float)(h[i].timestamp - t->ts_start);\
+										\
+			int chan = 0;						\
+			while (chan < N) {					\
+				y[chan][i] = t->y_offset[chan] - t->y_scale[chan] * (float)h[i].value[chan];\
+				chan++;						\
+			}							\
+			i++;							\
+		}								\
+	}
+
+DECLARE_DRAW_KERNEL(1);
+DECLARE_DRAW_KERNEL(2);
+DECLARE_DRAW_KERNEL(3);
+DECLARE_DRAW_KERNEL(4);
+DECLARE_DRAW_KERNEL(5);
+DECLARE_DRAW_KERNEL(6);
+DECLARE_DRAW_KERNEL(7);
+
+#if MAX_REAL_CHANNELS != 7
+	#error Update draw_kernels[] to MAX_REAL_CHANNELS
+#endif
+
+static draw_kernel_t draw_kernels[MAX_REAL_CHANNELS + 1] = {
+	NULL,
+	draw_kernel_1,
+	draw_kernel_2,
+	draw_kernel_3,
+	draw_kernel_4,
+	draw_kernel_5,
+	draw_kernel_6,
+	draw_kernel_7,
+};
+
+draw_kernel_t draw_kernel = NULL;
+
+void draw_kernel_select(int channels) {
+	draw_kernel = draw_kernels[channels];
+}
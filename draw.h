@@ -0,0 +1,51 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_DRAW_H
+#define __VOLTLOGGER_DRAW_H
+
+#include <stddef.h>	/* size_t	*/
+
+#include "history.h"
+
+/*
+ * Affine transformation of history records to pixel coordinates:
+ *
+ *	x       = x_offset       + x_scale       * (timestamp - ts_start)
+ *	y[chan] = y_offset[chan] - y_scale[chan] * value[chan]
+ */
+typedef struct {
+	uint64_t ts_start;
+	float    x_offset;
+	float    x_scale;
+	float    y_offset[MAX_REAL_CHANNELS];
+	float    y_scale [MAX_REAL_CHANNELS];
+} draw_transform_t;
+
+/*
+ * Transforms "count" records in one pass for all the channels. There's a
+ * kernel specialized for every channel count; select it once with
+ * draw_kernel_select().
+ */
+typedef void (*draw_kernel_t)(const history_t *h, size_t count, const draw_transform_t *t, float *x, float *y[MAX_REAL_CHANNELS]);
+
+extern draw_kernel_t draw_kernel;
+extern void draw_kernel_select(int channels);
+
+#endif
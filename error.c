@@ -20,6 +20,11 @@
 /*
  * This file implements way to output debugging information. It's supposed
  * to be slow but convenient functions.
+ *
+ * After error_init_async() messages (except critical ones) are formatted by
+ * the calling thread into its own lock-free ring and written out by a
+ * background flusher, so logging never blocks on the output. If a ring is
+ * full, the message is dropped and counted.
  */
 
 #include "configuration.h"
@@ -35,8 +40,10 @@
 #include <sys/types.h>	/* getpid() */
 #include <unistd.h>	/* getpid() */
 
+#include "macros.h"
 #include "error.h"
 #include "pthreadex.h"
+#include "stats.h"
 
 static int zero     = 0;
 static int three    = 3;
@@ -170,6 +177,150 @@ static flushfunct_t flushfunct[] = {
 	[OM_SYSLOG]	= (flushfunct_t)syslog_flush,
 };
 
+typedef struct {
+	int  level;
+	char msg[LOG_MSG_SIZE];
+} log_entry_t;
+
+typedef struct log_ring {
+	struct log_ring	*next;
+	uint64_t	 head;		/* written by the owner thread only	*/
+	uint64_t	 tail;		/* written by the flusher only		*/
+	uint64_t	 dropped;
+	log_entry_t	 entry[LOG_RING_SIZE];
+} log_ring_t;
+
+static __thread log_ring_t *log_ring_local = NULL;
+static log_ring_t *log_rings = NULL;
+static int         log_async = 0;
+static pthread_t   log_flusher_thread;
+
+static pthread_lockstat_t log_output_lockstat  = PTHREAD_LOCKSTAT_INITIALIZER("log_output");
+static pthread_lockstat_t log_flusher_lockstat = PTHREAD_LOCKSTAT_INITIALIZER("log_flusher");
+
+static int log_lock() {
+	if (error_mutex_p == NULL)
+		return 0;
+
+	return !pthread_mutex_reltimedlock_stat(error_mutex_p, &log_output_lockstat, 0, OUTPUT_LOCK_TIMEOUT);
+}
+
+static void log_unlock(int locked) {
+	if (locked)
+		pthread_mutex_unlock_stat(error_mutex_p, &log_output_lockstat);
+}
+
+static void log_output(int level, const char *msg) {
+	outputmethod_t method = *outputmethod;
+
+	outfunct[method]("%s", msg);
+	flushfunct[method](level);
+}
+
+/* Should be called with error_mutex locked (if any) */
+static void log_drain() {
+	log_ring_t *ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+
+	while (ring != NULL) {
+		uint64_t tail    = ring->tail;
+		uint64_t head    = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint64_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+
+		while (tail < head) {
+			log_entry_t *entry = &ring->entry[tail % LOG_RING_SIZE];
+			log_output(entry->level, entry->msg);
+			tail++;
+			__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		}
+
+		if (dropped) {
+			char msg[LOG_MSG_SIZE];
+			snprintf(msg, sizeof(msg), "Warning: %lu log messages were dropped (the log ring is full)", dropped);
+			log_output(LOG_WARNING, msg);
+		}
+
+		ring = ring->next;
+	}
+}
+
+static log_ring_t *log_ring_get() {
+	log_ring_t *ring = log_ring_local;
+
+	if (likely(ring != NULL))
+		return ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL)
+		return NULL;
+
+	ring->next = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+	while (!__atomic_compare_exchange_n(&log_rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+	log_ring_local = ring;
+	return ring;
+}
+
+static void log_submit(int level, const char *msg, size_t len) {
+	if (__atomic_load_n(&log_async, __ATOMIC_ACQUIRE)) {
+		log_ring_t *ring = log_ring_get();
+
+		if (likely(ring != NULL)) {
+			uint64_t head = ring->head;
+
+			if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+				__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+				return;
+			}
+
+			log_entry_t *entry = &ring->entry[head % LOG_RING_SIZE];
+			entry->level = level;
+			memcpy(entry->msg, msg, len + 1);
+			__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+			return;
+		}
+	}
+
+	int locked = log_lock();
+	log_output(level, msg);
+	log_unlock(locked);
+}
+
+static void log_vsubmit(int level, const char *level_name, int verbose_prefix, const char *const function_name, const char *suffix, const char *fmt, va_list args) {
+	char msg[LOG_MSG_SIZE];
+	int len;
+
+	if (verbose_prefix)
+		len = snprintf(msg, sizeof(msg), "%s (pid: %u; thread: %p): %s(): ", level_name, getpid(), (void *)pthread_self(), function_name);
+	else
+		len = snprintf(msg, sizeof(msg), "%s: ", level_name);
+
+	if (len < sizeof(msg))
+		len += vsnprintf(&msg[len], sizeof(msg) - len, fmt, args);
+
+	if (suffix != NULL && len < sizeof(msg))
+		len += snprintf(&msg[len], sizeof(msg) - len, "%s", suffix);
+
+	if (len >= sizeof(msg))
+		len = sizeof(msg) - 1;
+
+	log_submit(level, msg, len);
+}
+
+static void *log_flusher(void *arg) {
+	while (__atomic_load_n(&log_async, __ATOMIC_ACQUIRE)) {
+		// Blocking here is fine and keeps log_drain() single-consumer
+		if (error_mutex_p != NULL)
+			pthread_mutex_lock_stat(error_mutex_p, &log_flusher_lockstat);
+		log_drain();
+		if (error_mutex_p != NULL)
+			pthread_mutex_unlock_stat(error_mutex_p, &log_flusher_lockstat);
+
+		usleep(LOG_FLUSH_USECS);
+	}
+
+	return NULL;
+}
+
 void _critical(const char *const function_name, const char *fmt, ...) {
 	if (*quiet)
 		return;
@@ -181,6 +332,8 @@ void _critical(const char *const function_name, const char *fmt, ...) {
 	if (error_mutex_p != NULL)
 		pthread_mutex_timedlock(error_mutex_p, &abs_time);
 
+	log_drain();
+
 	outputmethod_t method = *outputmethod;
 
 	{
@@ -228,7 +381,9 @@ void _critical(const char *const function_name, const char *fmt, ...) {
 }
 
 void _error(const char *const function_name, const char *fmt, ...) {
+	char suffix[BUFSIZ] = {0};
 	va_list args;
+	int errno_saved = errno;
 
 	if (*quiet)
 		return;
@@ -236,23 +391,12 @@ void _error(const char *const function_name, const char *fmt, ...) {
 	if (*verbose < 1)
 		return;
 
-	if (error_mutex_p != NULL)
-		pthread_mutex_reltimedlock(error_mutex_p, 0, OUTPUT_LOCK_TIMEOUT);
-
-	pthread_t thread = pthread_self();
-	pid_t pid = getpid();
-	outputmethod_t method = *outputmethod;
+	if (errno_saved)
+		snprintf(suffix, sizeof(suffix), " (%i: %s)", errno_saved, strerror(errno_saved));
 
-	outfunct[method](*debug ? "Error (pid: %u; thread: %p): %s(): " : "Error: ", pid, thread, function_name);
 	va_start(args, fmt);
-	voutfunct[method](fmt, args);
+	log_vsubmit(LOG_ERR, "Error", *debug, function_name, suffix, fmt, args);
 	va_end(args);
-	if (errno)
-		outfunct[method](" (%i: %s)", errno, strerror(errno));
-	flushfunct[method](LOG_ERR);
-
-	if (error_mutex_p != NULL)
-		pthread_mutex_unlock(error_mutex_p);
 	return;
 }
 
@@ -265,21 +409,9 @@ void _info(const char *const function_name, const char *fmt, ...) {
 	if (*verbose < 3)
 		return;
 
-	if (error_mutex_p != NULL)
-		pthread_mutex_reltimedlock(error_mutex_p, 0, OUTPUT_LOCK_TIMEOUT);
-
-	pthread_t thread = pthread_self();
-	pid_t pid = getpid();
-	outputmethod_t method = *outputmethod;
-
-	outfunct[method](*debug ? "Info (pid: %u; thread: %p): %s(): " : "Info: ", pid, thread, function_name);
 	va_start(args, fmt);
-	voutfunct[method](fmt, args);
+	log_vsubmit(LOG_INFO, "Info", *debug, function_name, NULL, fmt, args);
 	va_end(args);
-	flushfunct[method](LOG_INFO);
-
-	if (error_mutex_p != NULL)
-		pthread_mutex_unlock(error_mutex_p);
 	return;
 }
 
@@ -292,26 +424,44 @@ void _warning(const char *const function_name, const char *fmt, ...) {
 	if (*verbose < 2)
 		return;
 
-	if (error_mutex_p != NULL)
-		pthread_mutex_reltimedlock(error_mutex_p, 0, OUTPUT_LOCK_TIMEOUT);
+	va_start(args, fmt);
+	log_vsubmit(LOG_WARNING, "Warning", *debug, function_name, NULL, fmt, args);
+	va_end(args);
+	return;
+}
 
-	pthread_t thread = pthread_self();
-	pid_t pid = getpid();
-	outputmethod_t method = *outputmethod;
+/*
+ * Lets at most one message per LOG_RATELIMIT_NSECS through for the call
+ * site owning "rl". The message is suffixed by the number of suppressed
+ * ones. Returns 1 if the message was logged.
+ */
+int _warning_ratelimited(log_ratelimit_t *rl, const char *const function_name, const char *fmt, ...) {
+	char suffix[BUFSIZ] = {0};
+	va_list args;
+	uint64_t now = stats_now();
+	uint64_t next = __atomic_load_n(&rl->next, __ATOMIC_RELAXED);
+
+	if (now < next || !__atomic_compare_exchange_n(&rl->next, &next, now + LOG_RATELIMIT_NSECS, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&rl->suppressed, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	if (*quiet || *verbose < 2)
+		return 1;
+
+	uint64_t suppressed = __atomic_exchange_n(&rl->suppressed, 0, __ATOMIC_RELAXED);
+	if (suppressed)
+		snprintf(suffix, sizeof(suffix), " (%lu similar messages suppressed)", suppressed);
 
-	outfunct[method](*debug ? "Warning (pid: %u; thread: %p): %s(): " : "Warning: ", pid, thread, function_name);
 	va_start(args, fmt);
-	voutfunct[method](fmt, args);
+	log_vsubmit(LOG_WARNING, "Warning", *debug, function_name, suffix, fmt, args);
 	va_end(args);
-	flushfunct[method](LOG_WARNING);
-
-	if (error_mutex_p != NULL)
-		pthread_mutex_unlock(error_mutex_p);
-	return;
+	return 1;
 }
 
 #ifdef _DEBUG_SUPPORT
 void _debug(int debug_level, const char *const function_name, const char *fmt, ...) {
+	char level_name[32];
 	va_list args;
 
 	if (*quiet)
@@ -320,21 +470,11 @@ void _debug(int debug_level, const char *const function_name, const char *fmt, .
 	if (debug_level > *debug)
 		return;
 
-	if (error_mutex_p != NULL)
-		pthread_mutex_reltimedlock(error_mutex_p, 0, OUTPUT_LOCK_TIMEOUT);
-
-	pthread_t thread = pthread_self();
-	pid_t pid = getpid();
-	outputmethod_t method = *outputmethod;
+	snprintf(level_name, sizeof(level_name), "Debug%u", debug_level);
 
-	outfunct[method]("Debug%u (pid: %u; thread: %p): %s(): ", debug_level, pid, thread, function_name);
 	va_start(args, fmt);
-	voutfunct[method](fmt, args);
+	log_vsubmit(LOG_DEBUG, level_name, 1, function_name, NULL, fmt, args);
 	va_end(args);
-	flushfunct[method](LOG_DEBUG);
-
-	if (error_mutex_p != NULL)
-		pthread_mutex_unlock(error_mutex_p);
 	return;
 }
 #endif
@@ -367,7 +507,27 @@ void error_init_ipc(ipc_type_t _ipc_type) {
 	return;
 }
 
+void error_init_async() {
+	__atomic_store_n(&log_async, 1, __ATOMIC_RELEASE);
+
+	if (pthread_create(&log_flusher_thread, NULL, log_flusher, NULL)) {
+		__atomic_store_n(&log_async, 0, __ATOMIC_RELEASE);
+		error("Cannot create a thread");
+	}
+
+	return;
+}
+
 void error_deinit() {
+	if (__atomic_exchange_n(&log_async, 0, __ATOMIC_ACQ_REL)) {
+		if (!pthread_equal(pthread_self(), log_flusher_thread))
+			pthread_join(log_flusher_thread, NULL);
+
+		int locked = log_lock();
+		log_drain();
+		log_unlock(locked);
+	}
+
 	switch (ipc_type) {
 		case IPCT_PRIVATE:
 			break;
@@ -20,6 +20,8 @@
 #ifndef __CLSYNC_ERROR_H
 #define __CLSYNC_ERROR_H
 
+#include <stdint.h>	/* uint64_t	*/
+
 #define BACKTRACE_LENGTH	256
 
 #ifdef _DEBUG_FORCE
@@ -42,6 +44,14 @@ extern void _warning(const char *const function_name, const char *fmt, ...);
 extern void _info(const char *const function_name, const char *fmt, ...);
 #define info(...) 				_info(__FUNCTION__, __VA_ARGS__)
 
+typedef struct {
+	uint64_t next;
+	uint64_t suppressed;
+} log_ratelimit_t;
+
+extern int _warning_ratelimited(log_ratelimit_t *rl, const char *const function_name, const char *fmt, ...);
+#define warning_ratelimited(...)		({static log_ratelimit_t _rl; _warning_ratelimited(&_rl, __FUNCTION__, __VA_ARGS__);})
+
 #ifdef _DEBUG_SUPPORT
 	extern void _debug(int debug_level, const char *const function_name, const char *fmt, ...);
 #	define debug(debug_level, ...)			{if (debug_level < DEBUGLEVEL_LIMIT) _debug(debug_level, __FUNCTION__, __VA_ARGS__);}
@@ -64,6 +74,7 @@ typedef enum ipc_type ipc_type_t;
 
 extern void error_init(void *_outputmethod, int *_quiet, int *_verbose, int *_debug);
 extern void error_init_ipc(ipc_type_t ipc_type);
+extern void error_init_async();
 extern void error_deinit();
 
 enum outputmethod {
@@ -0,0 +1,403 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "filter.h"
+#include "error.h"
+
+filter_config_t filters[FILTERS_MAX];
+int             filters_num = 0;
+
+/* Coefficients of the lanes, set up by filter_setup() */
+static filter_lanes_t filter_h[FILTER_TAPS_MAX];
+static int            filter_taps = 1;
+static filter_lanes_t filter_b0, filter_b1, filter_b2, filter_a1, filter_a2;
+static filter_lanes_t filter_offset;
+static char           filter_iir = 0;
+
+/*
+ * Parses "<channel>:<kind>[,freq=<Hz>][,q=<Q>][,rate=<Hz>][,taps=<N>]"
+ * and adds the filter. Returns 0 on success.
+ */
+int filter_parse(char *spec) {
+	char *const kinds[] = {
+		[FILTER_LOWPASS]  = "lowpass",
+		[FILTER_HIGHPASS] = "highpass",
+		[FILTER_BANDPASS] = "bandpass",
+		[FILTER_NOTCH]    = "notch",
+		NULL
+	};
+	enum {
+		OPT_FREQ = 0,
+		OPT_Q,
+		OPT_RATE,
+		OPT_TAPS,
+	};
+	char *const options[] = {
+		[OPT_FREQ] = "freq",
+		[OPT_Q]    = "q",
+		[OPT_RATE] = "rate",
+		[OPT_TAPS] = "taps",
+		NULL
+	};
+	filter_config_t c = { 0 };
+	char *value, *end;
+	int kind;
+
+	if (filters_num >= FILTERS_MAX) {
+		error("Too many filters, the maximum is %u", FILTERS_MAX);
+		return EINVAL;
+	}
+
+	c.input = strtol(spec, &end, 10);
+	if (end == spec || *end != ':') {
+		error("A filter should be \"<channel>:<kind>[,option=value...]\", got \"%s\"", spec);
+		return EINVAL;
+	}
+	spec = end + 1;
+
+	kind = getsubopt(&spec, kinds, &value);
+	if (kind < 0 || value != NULL) {
+		error("Unknown filter \"%s\"", value != NULL ? value : spec);
+		return EINVAL;
+	}
+	c.kind = kind;
+	c.q    = kind == FILTER_BANDPASS || kind == FILTER_NOTCH ? FILTER_Q_NARROW_DEFAULT : FILTER_Q_DEFAULT;
+
+	while (*spec) {
+		int opt = getsubopt(&spec, options, &value);
+
+		if (opt >= 0 && value == NULL) {
+			error("Filter option \"%s\" requires a value", options[opt]);
+			return EINVAL;
+		}
+
+		switch (opt) {
+			case OPT_FREQ:
+				c.freq = atof(value);
+				break;
+			case OPT_Q:
+				c.q    = atof(value);
+				break;
+			case OPT_RATE:
+				c.rate = atof(value);
+				break;
+			case OPT_TAPS:
+				c.taps = atoi(value);
+				break;
+			default:
+				error("Unknown filter option \"%s\"", value);
+				return EINVAL;
+		}
+	}
+
+	if (c.input < 0 || c.input >= MAX_REAL_CHANNELS) {
+		error("Filter channel %i is out of range", c.input);
+		return EINVAL;
+	}
+
+	if (c.rate <= 0 || c.freq <= 0 || c.freq >= c.rate / 2) {
+		error("A filter needs its frequency in (0; rate/2) and the sample rate");
+		return EINVAL;
+	}
+
+	if (c.q <= 0) {
+		error("Filter Q should be positive");
+		return EINVAL;
+	}
+
+	// Odd, so the FIR has a center tap for the spectral inversion
+	if (c.taps < 0 || c.taps > FILTER_TAPS_MAX || (c.taps && (c.taps < 3 || !(c.taps & 1)))) {
+		error("FIR taps should be odd and in [3; %u]", FILTER_TAPS_MAX);
+		return EINVAL;
+	}
+
+	filters[filters_num++] = c;
+	return 0;
+}
+
+/* Windowed-sinc (Blackman) lowpass of the cutoff "fc" (of the sample rate) added to "h" with "sign" */
+static void filter_fir_lowpass(double *h, int taps, double fc, double sign) {
+	double sum = 0;
+	int m = taps - 1;
+	int i = 0;
+
+	while (i < taps) {
+		double x = i - m / 2.0;
+		double w = 0.42 - 0.5 * cos(2 * M_PI * i / m) + 0.08 * cos(4 * M_PI * i / m);
+
+		h[taps + i] = (x == 0 ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x)) * w;
+		sum += h[taps + i];
+		i++;
+	}
+
+	// Unity gain at DC
+	i = 0;
+	while (i < taps) {
+		h[i] += sign * h[taps + i] / sum;
+		i++;
+	}
+}
+
+/* The FIR of "c" into "h" (2 * taps long, the second half is scratch) */
+static void filter_fir(const filter_config_t *c, double *h) {
+	double f  = c->freq / c->rate;
+	double f1 = MAX(f - f / c->q / 2, 0);
+	double f2 = MIN(f + f / c->q / 2, 0.5);
+	int center = c->taps / 2;
+
+	memset(h, 0, c->taps * sizeof(*h));
+	switch (c->kind) {
+		case FILTER_LOWPASS:
+			filter_fir_lowpass(h, c->taps, f, 1);
+			break;
+		case FILTER_HIGHPASS:
+			h[center] = 1;
+			filter_fir_lowpass(h, c->taps, f, -1);
+			break;
+		case FILTER_BANDPASS:
+			filter_fir_lowpass(h, c->taps, f2,  1);
+			filter_fir_lowpass(h, c->taps, f1, -1);
+			break;
+		case FILTER_NOTCH:
+			h[center] = 1;
+			filter_fir_lowpass(h, c->taps, f2, -1);
+			filter_fir_lowpass(h, c->taps, f1,  1);
+			break;
+	}
+}
+
+/* The biquad of "c" (RBJ's cookbook), normalized to a0 = 1 */
+static void filter_biquad(const filter_config_t *c, double b[3], double a[3]) {
+	double w0    = 2 * M_PI * c->freq / c->rate;
+	double cosw0 = cos(w0);
+	double alpha = sin(w0) / (2 * c->q);
+	double a0    = 1 + alpha;
+	int i = 0;
+
+	a[0] = a0;
+	a[1] = -2 * cosw0;
+	a[2] = 1 - alpha;
+	switch (c->kind) {
+		case FILTER_LOWPASS:
+			b[0] = (1 - cosw0) / 2;
+			b[1] =  1 - cosw0;
+			b[2] = (1 - cosw0) / 2;
+			break;
+		case FILTER_HIGHPASS:
+			b[0] =  (1 + cosw0) / 2;
+			b[1] = -(1 + cosw0);
+			b[2] =  (1 + cosw0) / 2;
+			break;
+		case FILTER_BANDPASS:
+			b[0] =  alpha;
+			b[1] =  0;
+			b[2] = -alpha;
+			break;
+		case FILTER_NOTCH:
+			b[0] =  1;
+			b[1] = -2 * cosw0;
+			b[2] =  1;
+			break;
+	}
+
+	while (i < 3) {
+		b[i] /= a0;
+		a[i] /= a0;
+		i++;
+	}
+}
+
+/*
+ * Assigns the virtual channels after the "channels" real ones and computes
+ * the coefficients of the lanes. Returns the total number of channels, or
+ * -1 if they don't fit into a record.
+ */
+int filter_setup(int channels) {
+	static double h[2 * FILTER_TAPS_MAX];
+	int i = 0;
+
+	if (channels + filters_num >= MAX_REAL_CHANNELS) {
+		error("%i channels and %i filters don't fit into %i channels", channels, filters_num, MAX_REAL_CHANNELS - 1);
+		return -1;
+	}
+
+	// Identity everywhere, the unused lanes included
+	memset(filter_h, 0, sizeof(filter_h));
+	filter_taps = 1;
+	i = 0;
+	while (i < FILTER_LANES) {
+		filter_h[0][i] = 1;
+		filter_b0  [i] = 1;
+		filter_b1  [i] = filter_b2[i] = filter_a1[i] = filter_a2[i] = 0;
+		filter_offset[i] = 0;
+		i++;
+	}
+	filter_iir = 0;
+
+	i = 0;
+	while (i < filters_num) {
+		filter_config_t *c = &filters[i];
+		int k = 0;
+
+		if (c->input >= channels) {
+			error("Filter channel %i is out of range", c->input);
+			return -1;
+		}
+		c->output = channels + i;
+
+		if (c->taps) {
+			filter_fir(c, h);
+			while (k < c->taps) {
+				filter_h[k][i] = h[k];
+				k++;
+			}
+			filter_taps = MAX(filter_taps, c->taps);
+		} else {
+			double b[3], a[3];
+
+			filter_biquad(c, b, a);
+			filter_b0[i] = b[0];
+			filter_b1[i] = b[1];
+			filter_b2[i] = b[2];
+			filter_a1[i] = a[1];
+			filter_a2[i] = a[2];
+			filter_iir = 1;
+		}
+
+		// No DC to keep: centered like the raw values
+		if (c->kind == FILTER_HIGHPASS || c->kind == FILTER_BANDPASS)
+			filter_offset[i] = 1 << (Y_BITS - 1);
+		i++;
+	}
+
+	return channels + filters_num;
+}
+
+/* Starts the state as if the first input had always been there, so there's no step response */
+static void filter_prime(filter_bank_t *bank, filter_lanes_t x) {
+	filter_lanes_t dc = {0};
+	filter_lanes_t u, y;
+	int k = 0;
+
+	while (k < filter_taps - 1)
+		bank->x[k++] = x;
+
+	k = 0;
+	while (k < filter_taps)
+		dc += filter_h[k++];
+
+	u = x * dc;
+	y = u * (filter_b0 + filter_b1 + filter_b2) / (1 + filter_a1 + filter_a2);
+	bank->z1 = y - filter_b0 * u;
+	bank->z2 = filter_b2 * u - filter_a2 * y;
+	bank->primed = 1;
+}
+
+/* Runs the filters on "count" records, continuing the state of "bank" */
+void filter_block(filter_bank_t *bank, history_t *records, size_t count) {
+	const int   taps = filter_taps;
+	const double top = (1 << Y_BITS) - 1;
+	size_t done = 0;
+
+	if (filters_num == 0)
+		return;
+
+	while (done < count) {
+		history_t      *r = &records[done];
+		filter_lanes_t *x = &bank->x[taps - 1];
+		filter_lanes_t *y = bank->y;
+		size_t n = MIN(count - done, FILTER_BLOCK);
+		size_t i = 0;
+		int    k = 0;
+
+		while (i < n) {
+			filter_lanes_t v = {0};
+			int f = 0;
+
+			while (f < filters_num) {
+				v[f] = r[i].value[filters[f].input];
+				f++;
+			}
+			x[i++] = v;
+		}
+
+		if (unlikely(!bank->primed))
+			filter_prime(bank, x[0]);
+
+		// FIR: a tap at a time over the whole block, so the inner loop is a plain vector multiply-add
+		i = 0;
+		while (i < n) {
+			y[i] = filter_h[0] * x[i];
+			i++;
+		}
+		k = 1;
+		while (k < taps) {
+			filter_lanes_t  h  = filter_h[k];
+			filter_lanes_t *xk = x - k;
+
+			i = 0;
+			while (i < n) {
+				y[i] += h * xk[i];
+				i++;
+			}
+			k++;
+		}
+
+		if (filter_iir) {
+			filter_lanes_t z1 = bank->z1, z2 = bank->z2;
+
+			i = 0;
+			while (i < n) {
+				filter_lanes_t u = y[i];
+
+				y[i] = filter_b0 * u + z1;
+				z1   = filter_b1 * u - filter_a1 * y[i] + z2;
+				z2   = filter_b2 * u - filter_a2 * y[i];
+				i++;
+			}
+			bank->z1 = z1;
+			bank->z2 = z2;
+		}
+
+		i = 0;
+		while (i < n) {
+			filter_lanes_t v = y[i] + filter_offset;
+			int f = 0;
+
+			while (f < filters_num) {
+				r[i].value[filters[f].output] = v[f] <= 0 ? 0 : v[f] >= top ? top : (uint32_t)(v[f] + 0.5);
+				f++;
+			}
+			i++;
+		}
+
+		// Keep the last inputs for the next block
+		memmove(bank->x, &bank->x[n], (taps - 1) * sizeof(*bank->x));
+		done += n;
+	}
+}
@@ -0,0 +1,80 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_FILTER_H
+#define __VOLTLOGGER_FILTER_H
+
+#include <stddef.h>	/* size_t	*/
+
+#include "history.h"
+
+/*
+ * Filter stage of the ingest path: every filter reads a channel and writes
+ * its output into a virtual channel after the real ones, so the filtered
+ * traces are stored, drawn, served and triggered on like the raw ones.
+ *
+ * The filters run together on blocks of records, a vector lane per filter:
+ * the block's inputs are gathered, put through a FIR (of the longest taps,
+ * the shorter ones are padded with zeros) and a biquad IIR, and scattered
+ * back. A FIR filter has an identity IIR and vice versa.
+ */
+
+#define FILTERS_MAX		(MAX_REAL_CHANNELS - 1)
+#define FILTER_LANES		8		/* >= FILTERS_MAX, a power of 2 */
+#define FILTER_TAPS_MAX		1023
+#define FILTER_BLOCK		256		/* records */
+
+#define FILTER_Q_DEFAULT	0.7071		/* lowpass and highpass */
+#define FILTER_Q_NARROW_DEFAULT	10		/* bandpass and notch */
+
+enum filter_kind {
+	FILTER_LOWPASS = 0,
+	FILTER_HIGHPASS,
+	FILTER_BANDPASS,
+	FILTER_NOTCH,
+};
+
+typedef struct {
+	enum filter_kind kind;
+	int    input;			/* channel			*/
+	int    output;			/* virtual channel		*/
+	double freq;			/* Hz: the cutoff or the center	*/
+	double q;
+	double rate;			/* samples per second		*/
+	int    taps;			/* FIR of ..., 0 -- biquad IIR	*/
+} filter_config_t;
+
+typedef double filter_lanes_t __attribute__ ((vector_size (FILTER_LANES * sizeof(double))));
+
+/* State of a sequence of blocks, zero-initialized */
+typedef struct {
+	char           primed;
+	filter_lanes_t z1, z2;		/* IIR, transposed direct form II		*/
+	filter_lanes_t x[FILTER_TAPS_MAX - 1 + FILTER_BLOCK];	/* FIR: the previous inputs and the block */
+	filter_lanes_t y[FILTER_BLOCK];
+} filter_bank_t;
+
+extern filter_config_t filters[FILTERS_MAX];
+extern int             filters_num;
+
+extern int  filter_parse(char *spec);
+extern int  filter_setup(int channels);
+extern void filter_block(filter_bank_t *bank, history_t *records, size_t count);
+
+#endif
@@ -0,0 +1,399 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>	/* shm_unlink()	*/
+
+#include "macros.h"
+#include "error.h"
+#include "history.h"
+#include "logic.h"
+#include "malloc.h"
+#include "stats.h"
+
+history_t      *history;
+uint64_t        history_size   = HISTORY_SIZE_DEFAULT;
+uint64_t        history_length = 0;
+history_view_t *history_view;
+
+static history_view_t        history_view_private;
+static history_shm_header_t *history_shm      = NULL;
+static size_t                history_shm_size = 0;
+static const char           *history_shm_name = NULL;
+static uint64_t              history_generation = 0;
+
+history_run_t *history_runs       = NULL;
+uint64_t       history_runs_count = 0;
+
+static uint64_t history_runs_indexed  = 0;	/* records [0; indexed) are covered by the runs	*/
+
+uint64_t history_decimation = 1;
+
+static inline size_t history_bytes(uint64_t size) {
+	return (size * 2 + 1) * sizeof(history_t);
+}
+
+/*
+ * The buffer holds two halves of "size" records (+1 spare record) and is
+ * committed lazily, so an oversized history costs nothing until it's filled.
+ */
+void history_alloc(uint64_t size, int mmap_flags) {
+	history_size = size;
+	history      = mmap_malloc(history_bytes(size), mmap_flags);
+	history_view = &history_view_private;
+	history_runs = mmap_malloc(HISTORY_RUNS_MAX * sizeof(*history_runs), 0);
+	logic_alloc(size);
+}
+
+/*
+ * Producer side of a shared history store: viewer processes attach to it by
+ * the name with history_attach() and render without decoding anything.
+ */
+int history_alloc_shared(const char *name, uint64_t size, int channels, int mmap_flags) {
+	history_shm_size = HISTORY_SHM_HEADER_SIZE + history_bytes(size);
+	history_shm      = shm_malloc_named(name, history_shm_size, mmap_flags);
+	if (history_shm == NULL) {
+		error("Cannot create shared memory \"%s\"", name);
+		return -1;
+	}
+	history_shm_name = name;
+
+	history_shm->version     = HISTORY_SHM_VERSION;
+	history_shm->channels    = channels;
+	history_shm->size        = size;
+	history_shm->record_size = sizeof(history_t);
+
+	history_size = size;
+	history      = (history_t *)((char *)history_shm + HISTORY_SHM_HEADER_SIZE);
+	history_view = &history_shm->view;
+	history_runs = mmap_malloc(HISTORY_RUNS_MAX * sizeof(*history_runs), 0);
+	logic_alloc(size);
+
+	__atomic_store_n(&history_shm->magic, HISTORY_SHM_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+ * Viewer side: maps the store read-only. The caller must not write to
+ * history[] or call history_commit()/history_flush().
+ */
+int history_attach(const char *name, int *channels_p) {
+	history_shm = shm_attach_named(name, &history_shm_size);
+	if (history_shm == NULL) {
+		error("Cannot attach to shared memory \"%s\"", name);
+		return -1;
+	}
+
+	if (history_shm_size < HISTORY_SHM_HEADER_SIZE ||
+	    __atomic_load_n(&history_shm->magic, __ATOMIC_ACQUIRE) != HISTORY_SHM_MAGIC ||
+	    history_shm->version     != HISTORY_SHM_VERSION ||
+	    history_shm->record_size != sizeof(history_t) ||
+	    history_shm_size < HISTORY_SHM_HEADER_SIZE + history_bytes(history_shm->size)) {
+		error("\"%s\" is not a compatible history store", name);
+		shm_free_named(history_shm, history_shm_size);
+		history_shm = NULL;
+		return -1;
+	}
+
+	history_size = history_shm->size;
+	history      = (history_t *)((char *)history_shm + HISTORY_SHM_HEADER_SIZE);
+	history_view = &history_shm->view;
+	*channels_p  = history_shm->channels;
+	return 0;
+}
+
+void history_set_channels(int channels) {
+	if (history_shm != NULL && history_shm_name != NULL)
+		history_shm->channels = channels;
+}
+
+/* Removes the name of the shared store (if we're its producer) */
+void history_unlink() {
+	if (history_shm_name != NULL) {
+		shm_unlink(history_shm_name);
+		history_shm_name = NULL;
+	}
+}
+
+void history_free() {
+	if (history_shm != NULL) {
+		history_unlink();
+		shm_free_named(history_shm, history_shm_size);
+		history_shm = NULL;
+	} else {
+		mmap_free(history, history_bytes(history_size));
+	}
+	history = NULL;
+
+	if (history_runs != NULL) {
+		mmap_free(history_runs, HISTORY_RUNS_MAX * sizeof(*history_runs));
+		history_runs       = NULL;
+		history_runs_count = 0;
+	}
+	logic_free();
+}
+
+static inline uint64_t history_ts_latest() {
+	return history_length ? history[history_length-1].timestamp : 0;
+}
+
+/*
+ * Makes room for new runs by merging pairs of the older half of the "n"
+ * runs into irregular runs (no period, see history_find()). A run that
+ * starts after a gap isn't merged into the previous one, unless there's no
+ * other pair to merge. Returns the new number of runs.
+ *
+ * Readers fall back to the search over the records meanwhile (no runs), a
+ * reader that has already loaded the count verifies what it finds.
+ */
+static uint64_t history_runs_compact(uint64_t n) {
+	uint64_t half = n / 2;
+	uint64_t i = 0, o = 0;
+	char     across_gaps = 0;
+
+	__atomic_store_n(&history_runs_count, 0, __ATOMIC_RELEASE);
+
+	while (1) {
+		while (i < half) {
+			history_run_t run = history_runs[i++];
+
+			if (i < half && (across_gaps || !history_runs[i].gap)) {
+				run.period  = 0;
+				run.count  += history_runs[i++].count;
+			}
+
+			history_runs[o++] = run;
+		}
+
+		if (o < half || across_gaps)
+			break;
+
+		// Every run of the older half starts after a gap: give up the oldest gaps
+		across_gaps = 1;
+		i = 0;
+		o = 0;
+	}
+
+	memmove(&history_runs[o], &history_runs[half], sizeof(*history_runs)*(n - half));
+	n = o + n - half;
+	__atomic_store_n(&history_runs_count, n, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* Extends the runs to the records [indexed; history_length) */
+static void history_runs_update(char rebuilding) {
+	if (history_runs == NULL)
+		return;
+
+	while (history_runs_indexed < history_length) {
+		uint64_t i  = history_runs_indexed++;
+		uint64_t ts = history[i].timestamp;
+		uint64_t n  = history_runs_count;
+		uint64_t gap = 0;
+
+		if (likely(n > 0)) {
+			history_run_t *r = &history_runs[n-1];
+
+			if (r->count == 1 && ts > r->ts_start) {
+				__atomic_store_n(&r->period, ts - r->ts_start, __ATOMIC_RELAXED);
+				__atomic_store_n(&r->count,  2,                __ATOMIC_RELEASE);
+				continue;
+			}
+
+			if (r->period) {
+				uint64_t predicted = r->ts_start + r->period * r->count;
+				uint64_t jitter    = r->period / HISTORY_RUN_JITTER;
+
+				if (ts + jitter >= predicted && ts <= predicted + jitter) {
+					// Follow the average period to not split a run on a slight clock drift
+					__atomic_store_n(&r->period, (ts - r->ts_start) / r->count, __ATOMIC_RELAXED);
+					__atomic_store_n(&r->count,  r->count + 1,                  __ATOMIC_RELEASE);
+					continue;
+				}
+
+				gap = ts > history[i-1].timestamp + r->period * HISTORY_GAP_PERIODS * history_decimation;
+			}
+		}
+
+		if (unlikely(n >= HISTORY_RUNS_MAX)) {
+			warning_ratelimited("Too irregular timestamps, more than %u runs, merging the oldest ones", HISTORY_RUNS_MAX);
+			n = history_runs_compact(n);
+		}
+
+		if (gap && !rebuilding)
+			stats_inc(STATS_GAPS, 1);
+
+		history_runs[n].index    = i;
+		history_runs[n].ts_start = ts;
+		history_runs[n].period   = 0;
+		history_runs[n].count    = 1;
+		history_runs[n].gap      = gap;
+		__atomic_store_n(&history_runs_count, n + 1, __ATOMIC_RELEASE);
+	}
+}
+
+/* Returns the run containing "ts" (the last run starting before it) */
+static inline int64_t history_run_find(uint64_t ts, uint64_t count) {
+	int64_t lo = 0, hi = count;
+
+	while (lo < hi) {
+		int64_t mid = lo + (hi - lo) / 2;
+
+		if (history_runs[mid].ts_start <= ts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo - 1;
+}
+
+/*
+ * Same as history_lower_bound(), but the position is estimated from the
+ * timestamp runs and only refined by a search over HISTORY_FIND_SLACK
+ * records around it.
+ */
+#define HISTORY_FIND_SLACK 8
+uint64_t history_find(uint64_t ts, uint64_t lo, uint64_t hi) {
+	uint64_t count = __atomic_load_n(&history_runs_count, __ATOMIC_ACQUIRE);
+	uint64_t est, a, b;
+	int64_t  r;
+
+	if (count == 0 || lo >= hi)
+		return history_lower_bound(ts, lo, hi);
+
+	r = history_run_find(ts, count);
+	if (r < 0) {
+		est = history_runs[0].index;
+	} else {
+		history_run_t *run = &history_runs[r];
+		uint64_t period = __atomic_load_n(&run->period, __ATOMIC_RELAXED);
+		uint64_t n      = __atomic_load_n(&run->count,  __ATOMIC_ACQUIRE);
+
+		// A merged run (see history_runs_compact()) is searched as a whole
+		if (!period && n > 1) {
+			a = MAX(MIN(run->index,     hi), lo);
+			b = MAX(MIN(run->index + n, hi), lo);
+			if ((a == lo || history[a-1].timestamp < ts) && (b == hi || history[b].timestamp >= ts))
+				return history_lower_bound(ts, a, b);
+
+			return history_lower_bound(ts, lo, hi);
+		}
+
+		est = run->index;
+		if (period)
+			est += MIN((ts - run->ts_start + period - 1) / period, n);
+		else
+			est += ts > run->ts_start;
+	}
+
+	est = MAX(MIN(est, hi), lo);
+	a   = est > lo + HISTORY_FIND_SLACK ? est - HISTORY_FIND_SLACK : lo;
+	b   = est + HISTORY_FIND_SLACK < hi ? est + HISTORY_FIND_SLACK : hi;
+	if ((a == lo || history[a-1].timestamp < ts) && (b == hi || history[b].timestamp >= ts))
+		return history_lower_bound(ts, a, b);
+
+	return history_lower_bound(ts, lo, hi);
+}
+
+/* Returns the first record in (index; hi) that follows a gap, or "hi" */
+uint64_t history_gap_next(uint64_t index, uint64_t hi) {
+	uint64_t count = __atomic_load_n(&history_runs_count, __ATOMIC_ACQUIRE);
+	int64_t  lo = 0, r = count;
+
+	// The first run starting after "index"
+	while (lo < r) {
+		int64_t mid = lo + (r - lo) / 2;
+
+		if (history_runs[mid].index <= index)
+			lo = mid + 1;
+		else
+			r = mid;
+	}
+
+	while (r < (int64_t)count && history_runs[r].index < hi) {
+		if (history_runs[r].gap)
+			return history_runs[r].index;
+		r++;
+	}
+
+	return hi;
+}
+
+/* Rebuilds the runs and the logic channels after the records have moved */
+static void history_reindex() {
+	__atomic_store_n(&history_runs_count, 0, __ATOMIC_RELEASE);
+	history_runs_indexed = 0;
+	history_runs_update(1);
+	logic_reset();
+	logic_update();
+}
+
+/* Publishes records [0; history_length) to the readers */
+void history_commit() {
+	history_runs_update(0);
+	logic_update();
+	history_publish(history_length, history_ts_latest(), history_generation);
+}
+
+void history_flush() {
+	uint64_t ts_start = stats_now();
+
+	history_publish(history_length, history_ts_latest(), ++history_generation);
+	// The odd generation is visible before any record moves (smp_wmb())
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(history, &history[history_size], sizeof(*history)*history_size);
+	history_length = history_size;
+
+	// Reindexing costs O(history_size) once per history_size records
+	history_reindex();
+	history_publish(history_length, history_ts_latest(), ++history_generation);
+
+	info("history_flush()");
+	stats_inc(STATS_FLUSHES, 1);
+	stats_time(STATS_H_FLUSH, ts_start);
+	return;
+}
+
+/*
+ * Backfill of a progressive open: puts "count" records older than
+ * history[0] in front of the published ones. The oldest of them are dropped
+ * if they don't fit. Like history_flush(), it's done under an odd
+ * generation, so readers retry instead of seeing the records move.
+ */
+void history_prepend(const history_t *older, uint64_t count) {
+	uint64_t room = history_size * 2 - 1 - history_length;
+
+	if (count > room) {
+		older += count - room;
+		count  = room;
+	}
+	if (count == 0)
+		return;
+
+	history_publish(history_length, history_ts_latest(), ++history_generation);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memmove(&history[count], history, sizeof(*history)*history_length);
+	memcpy(history, older, sizeof(*history)*count);
+	history_length += count;
+
+	history_reindex();
+	history_publish(history_length, history_ts_latest(), ++history_generation);
+}
@@ -0,0 +1,187 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_HISTORY_H
+#define __VOLTLOGGER_HISTORY_H
+
+#include <stdint.h>	/* uint64_t	*/
+
+#include "macros.h"
+
+/* Records per history half (see history_flush()); set with -N or -m */
+#define HISTORY_SIZE_DEFAULT (1 << 20)
+#define HISTORY_SIZE_MAX     (1 << 29)
+#define MAX_REAL_CHANNELS 7
+#define MAX_MATH_CHANNELS 3
+#define Y_BITS 12
+
+typedef struct {
+	uint64_t timestamp;
+	uint32_t value[MAX_REAL_CHANNELS];
+} history_t;
+
+/*
+ * The fetcher (the only writer) publishes what's valid in history[] through
+ * a seqlock-protected view descriptor, so readers never block it:
+ *
+ *	if (!history_snapshot(&view))
+ *		... history_flush() is in progress ...
+ *	... read history[0; view.length) ...
+ *	if (!history_snapshot_valid(&view))
+ *		... history_flush() moved the data meanwhile, discard the result ...
+ *
+ * "generation" is odd while history_flush() is moving the records.
+ * history_snapshot() also fails if the view stays being published for
+ * HISTORY_SNAPSHOT_SPINS attempts.
+ */
+#define HISTORY_SNAPSHOT_SPINS	(1 << 20)
+
+typedef struct {
+	uint64_t length;
+	uint64_t ts_latest;
+	uint64_t generation;
+} history_snapshot_t;
+
+typedef struct {
+	uint64_t           seq;
+	history_snapshot_t cur;
+} history_view_t;
+
+/*
+ * Shared history store (see history_alloc_shared()): the header followed by
+ * the records at HISTORY_SHM_HEADER_SIZE. Viewer processes map it read-only
+ * and read it through the same seqlock view.
+ */
+#define HISTORY_SHM_MAGIC	0x5453494854564c00ULL
+#define HISTORY_SHM_VERSION	1
+#define HISTORY_SHM_HEADER_SIZE	4096
+
+typedef struct {
+	uint64_t       magic;
+	uint32_t       version;
+	uint32_t       channels;
+	uint64_t       size;
+	uint64_t       record_size;
+	history_view_t view;
+} history_shm_header_t;
+
+extern history_t      *history;
+extern uint64_t        history_size;
+extern uint64_t        history_length;
+extern history_view_t *history_view;
+
+static inline void history_publish(uint64_t length, uint64_t ts_latest, uint64_t generation) {
+	uint64_t seq = history_view->seq;
+
+	__atomic_store_n(&history_view->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&history_view->cur.length,     length,     __ATOMIC_RELAXED);
+	__atomic_store_n(&history_view->cur.ts_latest,  ts_latest,  __ATOMIC_RELAXED);
+	__atomic_store_n(&history_view->cur.generation, generation, __ATOMIC_RELAXED);
+	__atomic_store_n(&history_view->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static inline int history_snapshot(history_snapshot_t *view) {
+	uint64_t seq;
+	int spins = HISTORY_SNAPSHOT_SPINS;
+
+	// A bounded wait: the writer may be another process, and it may have died mid-publish
+	while (spins--) {
+		seq = __atomic_load_n(&history_view->seq, __ATOMIC_ACQUIRE);
+		view->length     = __atomic_load_n(&history_view->cur.length,     __ATOMIC_RELAXED);
+		view->ts_latest  = __atomic_load_n(&history_view->cur.ts_latest,  __ATOMIC_RELAXED);
+		view->generation = __atomic_load_n(&history_view->cur.generation, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (!(seq & 1) && seq == __atomic_load_n(&history_view->seq, __ATOMIC_RELAXED))
+			return !(view->generation & 1);
+
+		cpu_relax();
+	}
+
+	return 0;
+}
+
+static inline int history_snapshot_valid(const history_snapshot_t *view) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&history_view->cur.generation, __ATOMIC_RELAXED) == view->generation;
+}
+
+/* Returns the first index in [lo; hi) with a timestamp >= "ts" (or "hi") */
+static inline uint64_t history_lower_bound(uint64_t ts, uint64_t lo, uint64_t hi) {
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (history[mid].timestamp < ts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Timestamp runs: the writer indexes the records as runs of a regular clock
+ * (the i-th record of a run is at ts_start + period*i, give or take
+ * period/HISTORY_RUN_JITTER), so history_find() locates a timestamp in
+ * O(log runs). A run that starts more than HISTORY_GAP_PERIODS periods
+ * after the previous record is marked as a gap (lost samples), the
+ * renderer doesn't connect the records across it. While the fetcher
+ * decimates (-O), the kept records are further apart by design, so the
+ * threshold is multiplied by "history_decimation".
+ *
+ * At most HISTORY_RUNS_MAX runs are kept: with a too irregular clock the
+ * oldest ones are merged into runs without a period, searched by a
+ * bisection over their records, keeping the gaps where possible.
+ *
+ * The runs are private to the writer process; if there're none (an
+ * attached viewer) the lookups fall back to a binary search over the
+ * records.
+ */
+#define HISTORY_RUNS_MAX	(1 << 16)
+#define HISTORY_RUN_JITTER	4
+#define HISTORY_GAP_PERIODS	4
+
+typedef struct {
+	uint64_t index;			/* the first record of the run	*/
+	uint64_t ts_start;
+	uint64_t period;		/* 0 for a single record or merged runs */
+	uint64_t count;
+	uint64_t gap;			/* the run starts after a gap	*/
+} history_run_t;
+
+extern history_run_t *history_runs;
+extern uint64_t       history_runs_count;
+extern uint64_t       history_decimation;
+
+extern uint64_t history_find(uint64_t ts, uint64_t lo, uint64_t hi);
+extern uint64_t history_gap_next(uint64_t index, uint64_t hi);
+
+extern void history_alloc(uint64_t size, int mmap_flags);
+extern int  history_alloc_shared(const char *name, uint64_t size, int channels, int mmap_flags);
+extern int  history_attach(const char *name, int *channels_p);
+extern void history_set_channels(int channels);
+extern void history_unlink();
+extern void history_free();
+extern void history_commit();
+extern void history_flush();
+extern void history_prepend(const history_t *older, uint64_t count);
+
+#endif
@@ -0,0 +1,799 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "configuration.h"
+#include "ingest.h"
+#include "binlog.h"
+#include "error.h"
+#include "filter.h"
+#include "malloc.h"
+#include "stats.h"
+#include "uring.h"
+
+/* Room before the data of a buffer for the tail of a record from the previous one */
+#define INGEST_HEADROOM	64
+
+typedef struct {
+	char   *data;			/* INGEST_HEADROOM bytes before it are ours too */
+	size_t  len;
+	char    end;
+	int     index;			/* in ingest_buffer_pool[] (and the registered buffers) */
+} ingest_buffer_t;
+
+typedef struct {
+	history_t *records;
+	uint64_t  *ts_parse;
+	size_t     count;
+	uint64_t   offset_end;		/* of the input after the batch */
+	char       end;
+} ingest_batch_t;
+
+/* The pools are never larger than the queues, so pushing never fails */
+#define INGEST_QUEUE_SIZE	MAX(INGEST_BUFFERS, INGEST_BATCHES)
+
+typedef struct {
+	void    *slot[INGEST_QUEUE_SIZE];
+	uint64_t head __attribute__((aligned(64)));	/* written by the consumer */
+	uint64_t tail __attribute__((aligned(64)));	/* written by the producer */
+} ingest_queue_t;
+
+static ingest_buffer_t *ingest_buffer_pool[INGEST_BUFFERS];
+
+static ingest_queue_t ingest_buffers_free;
+static ingest_queue_t ingest_buffers_full;
+static ingest_queue_t ingest_batches_free;
+static ingest_queue_t ingest_batches_full;
+
+static int       ingest_fd;
+static binlog_layout_t ingest_layout;
+static binlog_unwrap_t ingest_unwrap;		/* shared by the initial load and the decoder */
+static filter_bank_t   ingest_filter;		/* ditto */
+static size_t          ingest_stride = 1;	/* see ingest_set_stride() */
+static char      ingest_stop_at_eof;
+static char      ingest_running = 0;
+static uint64_t  ingest_offset;			/* of the first byte read */
+static uint64_t  ingest_published = 0;		/* offset after the current batch */
+static pthread_t ingest_reader_thread;
+static pthread_t ingest_decoder_thread;
+
+static ingest_batch_t *ingest_batch     = NULL;	/* being consumed by ingest_fetch() */
+static size_t          ingest_batch_pos = 0;
+
+static inline void ingest_queue_push(ingest_queue_t *q, void *p) {
+	uint64_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+	q->slot[tail % INGEST_QUEUE_SIZE] = p;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline void *ingest_queue_pop(ingest_queue_t *q) {
+	uint64_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	void *p;
+
+	if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	p = q->slot[head % INGEST_QUEUE_SIZE];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return p;
+}
+
+static inline int ingest_is_running() {
+	return __atomic_load_n(&ingest_running, __ATOMIC_RELAXED);
+}
+
+/*
+ * Waits for an item in "q" for about "usecs" (0 -- forever), returns NULL if
+ * there's none by then or the pipeline is stopped meanwhile
+ */
+static void *ingest_queue_wait_timed(ingest_queue_t *q, uint64_t usecs) {
+	uint64_t slept = 0;
+	int spins = 0;
+	void *p;
+
+	while ((p = ingest_queue_pop(q)) == NULL) {
+		if (!ingest_is_running())
+			return NULL;
+
+		if (spins++ < INGEST_SPINS) {
+			cpu_relax();
+			continue;
+		}
+
+		if (usecs && slept >= usecs)
+			return NULL;
+		usleep(INGEST_POLL_USECS);
+		slept += INGEST_POLL_USECS;
+	}
+
+	return p;
+}
+
+/* Waits for an item in "q", returns NULL if the pipeline is stopped meanwhile */
+static inline void *ingest_queue_wait(ingest_queue_t *q) {
+	return ingest_queue_wait_timed(q, 0);
+}
+
+/* Plain read() backend: for pipes and if io_uring isn't available. Takes the "spares" buffers first */
+static void ingest_reader_read(ingest_buffer_t **spare, int spares) {
+	ingest_buffer_t *b;
+
+	while ((b = spares ? spare[--spares] : ingest_queue_wait(&ingest_buffers_free)) != NULL) {
+		ssize_t r;
+
+		while (1) {
+			r = read(ingest_fd, b->data, INGEST_BUFFER_SIZE);
+			if (r > 0)
+				break;
+
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				error("Cannot read the input: %s", strerror(errno));
+				break;
+			}
+
+			if (ingest_stop_at_eof || !ingest_is_running())
+				break;
+
+			// Waiting for the writer (tail-follow)
+			usleep(AUTOUPDATE_USECS);
+		}
+
+		b->len = r > 0 ? r : 0;
+		b->end = r <= 0;
+		ingest_queue_push(&ingest_buffers_full, b);
+
+		if (b->end)
+			break;
+	}
+
+	return;
+}
+
+
+struct ingest_read {
+	ingest_buffer_t	*b;
+	uint64_t	 offset;
+	int		 res;
+	char		 done;
+};
+
+struct ingest_uring {
+	uring_t		 u;
+	unsigned	 unsubmitted;	/* the last of the queued reads, not taken by the kernel yet */
+	unsigned	 pending;	/* submitted, not completed yet */
+};
+
+/* Submits the queued reads, returns -1 on error */
+static int ingest_uring_submit(struct ingest_uring *ur) {
+	int rc = uring_submit(&ur->u);
+
+	if (rc < 0) {
+		error("Cannot submit reads: %s", strerror(errno));
+		return -1;
+	}
+
+	ur->unsubmitted -= MIN((unsigned)rc, ur->unsubmitted);
+	ur->pending     += rc;
+	return 0;
+}
+
+/* Reaps a completion into "reads", returns -1 on error or if nothing is submitted */
+static int ingest_uring_reap(struct ingest_uring *ur, struct ingest_read *reads) {
+	struct io_uring_cqe cqe;
+
+	if (ur->pending == 0) {
+		error("Cannot wait for reads: none is submitted");
+		return -1;
+	}
+
+	if (uring_wait(&ur->u, &cqe)) {
+		error("Cannot wait for reads: %s", strerror(errno));
+		return -1;
+	}
+
+	ur->pending--;
+	reads[cqe.user_data].res  = cqe.res;
+	reads[cqe.user_data].done = 1;
+	return 0;
+}
+
+/*
+ * io_uring backend for regular files: keeps INGEST_URING_DEPTH reads of
+ * consecutive parts of the file in flight (into the registered buffers if
+ * possible) and passes the completed buffers to the decoder in order. A
+ * short read is the end of the file for now: the reads after it are
+ * discarded and reissued from its end (after a pause if nothing was read).
+ *
+ * Returns -1 if io_uring isn't available, can't read the file (e.g. an
+ * older kernel without IORING_OP_READ) or fails: the input is positioned
+ * after the last buffer passed to the decoder, where ingest_reader_read()
+ * continues then, with the buffers left in "spare".
+ */
+static int ingest_reader_uring(ingest_buffer_t **spare, int *spares_p) {
+	struct ingest_read  reads[INGEST_URING_DEPTH];
+	struct iovec        iov  [INGEST_BUFFERS];
+	struct ingest_uring ur;
+	uint64_t offset   = ingest_offset;	/* of the next read to queue */
+	uint64_t resume   = ingest_offset;	/* after the data passed to the decoder */
+	unsigned first    = 0;
+	unsigned inflight = 0;		/* queued reads, submitted or not */
+	int      spares   = 0;
+	char     fixed, end = 0, fallback = 0;
+	int i;
+
+	*spares_p = 0;
+	memset(&ur, 0, sizeof(ur));
+	if (uring_init(&ur.u, INGEST_URING_DEPTH))
+		return -1;
+
+	i = 0;
+	while (i < INGEST_BUFFERS) {
+		iov[i].iov_base = ingest_buffer_pool[i]->data;
+		iov[i].iov_len  = INGEST_BUFFER_SIZE;
+		i++;
+	}
+	fixed = !uring_register_buffers(&ur.u, iov, INGEST_BUFFERS);
+	info("Reading the input with io_uring (%s buffers)", fixed ? "registered" : "unregistered");
+
+	while (!end && !fallback && ingest_is_running()) {
+		while (inflight < INGEST_URING_DEPTH) {
+			ingest_buffer_t *b = spares ? spare[--spares] : ingest_queue_pop(&ingest_buffers_free);
+			struct ingest_read  *r = &reads[(first + inflight) % INGEST_URING_DEPTH];
+			struct io_uring_sqe *sqe;
+
+			if (b == NULL)
+				break;
+
+			sqe = uring_get_sqe(&ur.u);
+			if (sqe == NULL) {
+				spare[spares++] = b;
+				break;
+			}
+			sqe->opcode    = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+			sqe->fd        = ingest_fd;
+			sqe->addr      = (uintptr_t)b->data;
+			sqe->len       = INGEST_BUFFER_SIZE;
+			sqe->off       = offset;
+			sqe->buf_index = fixed ? b->index : 0;
+			sqe->user_data = r - reads;
+
+			r->b      = b;
+			r->offset = offset;
+			r->done   = 0;
+			offset   += INGEST_BUFFER_SIZE;
+			inflight++;
+			ur.unsubmitted++;
+		}
+
+		if (ingest_uring_submit(&ur)) {
+			fallback = 1;
+			break;
+		}
+
+		// All the buffers are at the decoder
+		if (inflight == 0) {
+			ingest_buffer_t *b = ingest_queue_wait(&ingest_buffers_free);
+
+			if (b == NULL)
+				break;
+			spare[spares++] = b;
+			continue;
+		}
+
+		if (ingest_uring_reap(&ur, reads)) {
+			fallback = 1;
+			break;
+		}
+
+		while (inflight && reads[first].done) {
+			struct ingest_read *r = &reads[first];
+
+			if (r->res == -EINVAL || r->res == -EOPNOTSUPP) {
+				info("io_uring cannot read the input");
+				fallback = 1;
+				break;
+			}
+
+			first = (first + 1) % INGEST_URING_DEPTH;
+			inflight--;
+
+			if (r->res < 0 && r->res != -EINTR && r->res != -EAGAIN) {
+				error("Cannot read the input: %s", strerror(-r->res));
+				spare[spares++] = r->b;
+				end = 1;
+				break;
+			}
+
+			resume = r->offset + MAX(r->res, 0);
+			if (r->res > 0) {
+				r->b->len = r->res;
+				r->b->end = 0;
+				ingest_queue_push(&ingest_buffers_full, r->b);
+			} else {
+				spare[spares++] = r->b;
+			}
+
+			if (r->res == INGEST_BUFFER_SIZE)
+				continue;
+
+			// Short read: discard the reads beyond it (they're in the ring, so submit them first)
+			offset = resume;
+			while (inflight && !fallback) {
+				struct ingest_read *next = &reads[first];
+
+				if (next->done) {
+					spare[spares++] = next->b;
+					first = (first + 1) % INGEST_URING_DEPTH;
+					inflight--;
+					continue;
+				}
+
+				if (ur.unsubmitted == inflight && ingest_uring_submit(&ur))
+					fallback = 1;
+				else if (ingest_uring_reap(&ur, reads))
+					fallback = 1;
+			}
+
+			if (!fallback && r->res == 0) {
+				if (ingest_stop_at_eof) {
+					end = 1;
+					break;
+				}
+				// Waiting for the writer (tail-follow)
+				usleep(AUTOUPDATE_USECS);
+			}
+			break;
+		}
+	}
+
+	// The kernel may still write into the buffers of the submitted reads
+	while (ur.pending && !ingest_uring_reap(&ur, reads));
+	uring_deinit(&ur.u);
+
+	// The buffers of reads lost in the kernel can't be reused
+	if (ur.pending) {
+		error("Cannot reap the reads, giving up the input");
+		fallback = 0;
+		end      = 1;
+	} else {
+		while (inflight) {
+			spare[spares++] = reads[first].b;
+			first = (first + 1) % INGEST_URING_DEPTH;
+			inflight--;
+		}
+	}
+	*spares_p = spares;
+
+	if (fallback) {
+		info("Falling back to read()");
+		if (lseek(ingest_fd, resume, SEEK_SET) == (off_t)-1)
+			critical("Cannot seek the input");
+		return -1;
+	}
+
+	if (end) {
+		ingest_buffer_t *b = spares ? spare[--spares] : ingest_queue_wait(&ingest_buffers_free);
+
+		if (b != NULL) {
+			b->len = 0;
+			b->end = 1;
+			ingest_queue_push(&ingest_buffers_full, b);
+		}
+		*spares_p = spares;
+	}
+
+	return 0;
+}
+
+static void *ingest_reader(void *arg) {
+	ingest_buffer_t *spare[INGEST_BUFFERS];
+	int spares = 0;
+	struct stat st;
+
+	if (!fstat(ingest_fd, &st) && S_ISREG(st.st_mode) && !ingest_reader_uring(spare, &spares))
+		return NULL;
+
+	ingest_reader_read(spare, spares);
+	return NULL;
+}
+
+static void *ingest_decoder(void *arg) {
+	const size_t recsize = binlog_record_size(&ingest_layout);
+	char     carry[INGEST_HEADROOM];
+	size_t   carry_len = 0;
+	uint64_t offset    = ingest_offset;		/* of carry[0] */
+	uint64_t skipped_unreported = 0;
+	size_t   jump = 0;				/* left of a stride that went past the buffer */
+	ingest_buffer_t *b;
+
+	while ((b = ingest_queue_wait(&ingest_buffers_full)) != NULL) {
+		ingest_batch_t *batch = ingest_queue_wait(&ingest_batches_free);
+		size_t stride = __atomic_load_n(&ingest_stride, __ATOMIC_RELAXED);
+		binlog_range_t range;
+		size_t len, keep, skipped, from;
+		char *data;
+
+		if (batch == NULL)
+			break;
+
+		if (b->end) {
+			batch->count      = 0;
+			batch->offset_end = offset;
+			batch->end        = 1;
+			ingest_queue_push(&ingest_batches_full, batch);
+			break;
+		}
+
+		// Prepend the incomplete record left from the previous buffer
+		data = b->data - carry_len;
+		memcpy(data, carry, carry_len);
+		len  = carry_len + b->len;
+		from = MIN(jump, len);
+		jump -= from;
+
+		batch->count = binlog_decode_strided(data, len, from, len, &ingest_layout, stride, batch->records, batch->ts_parse, &range);
+		binlog_unwrap(&ingest_layout, &ingest_unwrap, batch->records, batch->count);
+		filter_block(&ingest_filter, batch->records, batch->count);
+		if (stride > 1)
+			stats_inc(STATS_DECIMATED_RECORDS, batch->count * (stride - 1));
+
+		if (range.records > 0) {
+			// The records jumped over aren't resync
+			keep    = MIN(range.next, len);
+			jump   += range.next - keep;
+			skipped = range.first - from + range.skipped;
+		} else {
+			// No complete record: keep what may be the start of one
+			keep    = range.first < len ? range.first : (len > recsize - 1 ? len - (recsize - 1) : 0);
+			keep    = MAX(keep, from);
+			skipped = keep - from;
+		}
+
+		carry_len = len - keep;
+		memcpy(carry, &data[keep], carry_len);
+		offset += keep;
+		ingest_queue_push(&ingest_buffers_free, b);
+
+		if (unlikely(skipped)) {
+			stats_inc(STATS_RESYNC_BYTES, skipped);
+			skipped_unreported += skipped;
+			if (warning_ratelimited("skipped %lu bytes to resync", skipped_unreported))
+				skipped_unreported = 0;
+		}
+
+		if (batch->count == 0) {
+			ingest_queue_push(&ingest_batches_free, batch);
+			continue;
+		}
+
+		batch->offset_end = offset;
+		batch->end        = 0;
+		ingest_queue_push(&ingest_batches_full, batch);
+	}
+
+	return NULL;
+}
+
+struct ingest_load_range {
+	const char	*map;
+	size_t		 size;
+	size_t		 from;
+	size_t		 to;
+	const binlog_layout_t *layout;
+	history_t	*rows;
+	binlog_range_t	 range;
+	pthread_t	 thread;
+};
+
+static void *ingest_load_worker(void *arg) {
+	struct ingest_load_range *r = arg;
+
+	r->rows = xmalloc(binlog_range_capacity(r->from, r->to, r->layout) * sizeof(*r->rows));
+	binlog_decode_range(r->map, r->size, r->from, r->to, r->layout, r->rows, NULL, &r->range);
+	return NULL;
+}
+
+/* Where to start decoding to get the last "records" records of [lo; hi) */
+static size_t ingest_load_from(const binlog_layout_t *layout, size_t records, uint64_t lo, uint64_t hi) {
+	const size_t recsize = binlog_record_size(layout);
+	size_t bytes;
+
+	// Some slack for garbage between the records
+	bytes = records * recsize;
+	bytes += bytes / 64 + recsize * BINLOG_SYNC_RECORDS;
+	return MAX(hi > bytes ? hi - bytes : 0, lo);
+}
+
+/*
+ * Decodes the records starting in [from; to) of a regular file with all
+ * the cores (every worker finds the first record boundary of its range by
+ * itself) and stitches the ranges in order into "out", keeping the last
+ * "max_records" of them. "from" > "lo" means it's in the middle of the
+ * data, so the bytes before the first record aren't counted as a resync.
+ *
+ * Stores the offsets of the first decoded record and right after the last
+ * one into "first_p" and "next_p". Returns the number of records or -1.
+ */
+static ssize_t ingest_load(int fd, const binlog_layout_t *layout, history_t *out, size_t max_records, uint64_t lo, uint64_t from, uint64_t to, binlog_unwrap_t *unwrap, uint64_t *first_p, uint64_t *next_p) {
+	struct ingest_load_range *range;
+	size_t per_range;
+	size_t loaded = 0, expected, skipped = 0;
+	char *map;
+	int threads, i;
+
+	map = mmap(NULL, to, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		error("Cannot mmap() the input: %s", strerror(errno));
+		return -1;
+	}
+	madvise(map + from, to - from, MADV_SEQUENTIAL);
+
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = MAX(MIN((size_t)threads, (to - from) / INGEST_LOAD_RANGE_MIN), 1);
+	per_range = (to - from + threads - 1) / threads;
+
+	range = xcalloc(threads, sizeof(*range));
+	i = 0;
+	while (i < threads) {
+		range[i].map      = map;
+		range[i].size     = to;
+		range[i].from     = from + i * per_range;
+		range[i].to       = MIN(range[i].from + per_range, to);
+		range[i].layout   = layout;
+		if (pthread_create(&range[i].thread, NULL, ingest_load_worker, &range[i]))
+			critical("Cannot create a thread");
+		i++;
+	}
+
+	*first_p = to;
+	expected = from;
+	i = 0;
+	while (i < threads) {
+		struct ingest_load_range *r = &range[i];
+
+		pthread_join(r->thread, NULL);
+
+		// Starting in the middle of the file isn't a resync
+		if (i == 0 && from > lo && r->range.records)
+			expected = r->range.first;
+
+		// A boundary found inside the previous range's last record: decode again from its end
+		if (r->range.records && r->range.first < expected) {
+			warning("Range %i starts at %lu, but the previous one ends at %lu", i, r->range.first, expected);
+			binlog_decode_range(map, to, expected, r->to, layout, r->rows, NULL, &r->range);
+		}
+
+		// Narrow timestamps can only be unwrapped in order
+		binlog_unwrap(layout, unwrap, r->rows, r->range.records);
+
+		if (r->range.records) {
+			if (*first_p == to)
+				*first_p = r->range.first;
+			skipped += r->range.first - expected + r->range.skipped;
+			expected = r->range.next;
+		}
+
+		// Only the last "max_records" are kept
+		size_t n = r->range.records;
+		history_t *rows = r->rows;
+		if (loaded + n > max_records) {
+			size_t drop = MIN(loaded + n - max_records, loaded);
+
+			memmove(out, &out[drop], (loaded - drop) * sizeof(*out));
+			loaded -= drop;
+			if (n > max_records) {
+				rows += n - max_records;
+				n     = max_records;
+			}
+		}
+		memcpy(&out[loaded], rows, n * sizeof(*out));
+		loaded += n;
+
+		free(r->rows);
+		i++;
+	}
+
+	munmap(map, to);
+	free(range);
+
+	if (skipped)
+		stats_inc(STATS_RESYNC_BYTES, skipped);
+	info("Loaded %lu records from %lu bytes with %i threads (%lu bytes skipped)", loaded, to - from, threads, skipped);
+
+	*next_p = expected;
+	return loaded;
+}
+
+/*
+ * Initial load of a regular file: decodes about the last "records" records
+ * of it into "out" (keeping at most "max_records"). Older records would be
+ * flushed out of the history anyway, so they aren't read (or are left to
+ * ingest_load_before()). Positions "fd" after the last decoded record
+ * and stores the offset into "offset_p" for ingest_start(), and the
+ * offset of the first decoded record into "first_p".
+ *
+ * Returns the number of records loaded (0 if "fd" isn't a regular file)
+ * or -1 on error.
+ */
+ssize_t ingest_load_tail(int fd, const binlog_layout_t *layout, history_t *out, size_t records, size_t max_records, uint64_t *offset_p, uint64_t *first_p) {
+	struct stat st;
+	uint64_t next;
+	ssize_t loaded;
+
+	*first_p = *offset_p;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || (uint64_t)st.st_size <= *offset_p)
+		return 0;
+
+	loaded = ingest_load(fd, layout, out, max_records, *offset_p, ingest_load_from(layout, records, *offset_p, st.st_size), st.st_size, &ingest_unwrap, first_p, &next);
+	if (loaded < 0)
+		return -1;
+
+	// The filters are sequential, the decoder continues their state
+	filter_block(&ingest_filter, out, loaded);
+
+	*offset_p = next;
+	if (lseek(fd, next, SEEK_SET) == (off_t)-1) {
+		error("Cannot seek the input: %s", strerror(errno));
+		return -1;
+	}
+
+	return loaded;
+}
+
+/*
+ * Backfill of a progressive open: decodes the last "max_records" records
+ * starting in [lo; hi) (before the records ingest_load_tail() returned)
+ * into "out". Doesn't touch the position of "fd", so it may run while
+ * the ingest is following the file.
+ *
+ * Narrow timestamps are unwrapped from the start of the range, not in the
+ * stream order, so this is for layouts with a full-width ts_device.
+ */
+ssize_t ingest_load_before(int fd, const binlog_layout_t *layout, history_t *out, size_t max_records, uint64_t lo, uint64_t hi) {
+	static filter_bank_t filter;
+	binlog_unwrap_t unwrap = { 0 };
+	uint64_t first, next;
+	ssize_t loaded;
+
+	if (hi <= lo || max_records == 0)
+		return 0;
+
+	loaded = ingest_load(fd, layout, out, max_records, lo, ingest_load_from(layout, max_records, lo, hi), hi, &unwrap, &first, &next);
+	if (loaded <= 0)
+		return loaded;
+
+	// Filtered from scratch: the state of the newer records is the decoder's
+	memset(&filter, 0, sizeof(filter));
+	filter_block(&filter, out, loaded);
+	return loaded;
+}
+
+/*
+ * Starts the reader and the decoder on "fd" (positioned at "offset"). With
+ * "stop_at_eof" the end of the input ends the stream, otherwise it's
+ * followed as the writer appends to it.
+ */
+int ingest_start(int fd, uint64_t offset, const binlog_layout_t *layout, char stop_at_eof) {
+	size_t capacity = binlog_range_capacity(0, INGEST_HEADROOM + INGEST_BUFFER_SIZE, layout);
+	int i;
+
+	ingest_fd          = fd;
+	ingest_layout      = *layout;
+	ingest_stop_at_eof = stop_at_eof;
+	ingest_offset      = offset;
+	ingest_published   = offset;
+	ingest_running     = 1;
+
+	i = 0;
+	while (i < INGEST_BUFFERS) {
+		ingest_buffer_t *b = xmalloc(sizeof(*b));
+
+		b->data  = (char *)xmalloc(INGEST_HEADROOM + INGEST_BUFFER_SIZE) + INGEST_HEADROOM;
+		b->index = i;
+		ingest_buffer_pool[i] = b;
+		ingest_queue_push(&ingest_buffers_free, b);
+		i++;
+	}
+
+	i = 0;
+	while (i < INGEST_BATCHES) {
+		ingest_batch_t *batch = xmalloc(sizeof(*batch));
+
+		batch->records  = xmalloc(capacity * sizeof(*batch->records));
+		batch->ts_parse = xmalloc(capacity * sizeof(*batch->ts_parse));
+		ingest_queue_push(&ingest_batches_free, batch);
+		i++;
+	}
+
+	// Not joined: the reader may be blocked on input
+	if (pthread_create(&ingest_reader_thread,  NULL, ingest_reader,  NULL) ||
+	    pthread_create(&ingest_decoder_thread, NULL, ingest_decoder, NULL)) {
+		error("Cannot create ingest threads");
+		return -1;
+	}
+	pthread_detach(ingest_reader_thread);
+	pthread_detach(ingest_decoder_thread);
+
+	return 0;
+}
+
+/*
+ * Makes the decoder decode only every "stride"-th record of the input
+ * from now on, jumping over the rest (1 -- all). The batches already
+ * decoded aren't affected.
+ */
+void ingest_set_stride(size_t stride) {
+	__atomic_store_n(&ingest_stride, MAX(stride, 1), __ATOMIC_RELAXED);
+}
+
+/*
+ * Publisher side: returns the next record (1) or 0 if the stream is over
+ * (or stopped by ingest_stop()).
+ */
+int ingest_fetch(history_t *p, uint64_t *ts_parse_p) {
+	return ingest_fetch_timed(p, ts_parse_p, 0);
+}
+
+/*
+ * Same as ingest_fetch(), but waits for the next record for about "usecs"
+ * (0 -- forever). Returns -1 if there's none yet, so the publisher can do
+ * something else meanwhile.
+ */
+int ingest_fetch_timed(history_t *p, uint64_t *ts_parse_p, uint64_t usecs) {
+	while (ingest_batch == NULL || ingest_batch_pos >= ingest_batch->count) {
+		if (ingest_batch != NULL) {
+			if (ingest_batch->end)
+				return 0;
+			ingest_queue_push(&ingest_batches_free, ingest_batch);
+		}
+
+		ingest_batch     = ingest_queue_wait_timed(&ingest_batches_full, usecs);
+		ingest_batch_pos = 0;
+		if (ingest_batch == NULL)
+			return usecs && ingest_is_running() ? -1 : 0;
+
+		__atomic_store_n(&ingest_published, ingest_batch->offset_end, __ATOMIC_RELAXED);
+	}
+
+	*p          = ingest_batch->records [ingest_batch_pos];
+	*ts_parse_p = ingest_batch->ts_parse[ingest_batch_pos];
+	ingest_batch_pos++;
+	return 1;
+}
+
+/* Returns the offset of the input up to which the records are taken by the publisher */
+uint64_t ingest_position() {
+	return __atomic_load_n(&ingest_published, __ATOMIC_RELAXED);
+}
+
+void ingest_stop() {
+	__atomic_store_n(&ingest_running, 0, __ATOMIC_RELAXED);
+}
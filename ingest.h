@@ -0,0 +1,62 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_INGEST_H
+#define __VOLTLOGGER_INGEST_H
+
+#include <stdint.h>
+#include <sys/types.h>	/* ssize_t	*/
+
+#include "history.h"
+#include "binlog.h"
+
+/*
+ * Pipelined ingest of a binlog stream:
+ *
+ *	reader  -- read()s the input into large buffers;
+ *	decoder -- decodes (and resyncs) the buffers into batches of records
+ *		   with binlog_decode_range();
+ *	publisher (the fetcher thread) -- takes the records by ingest_fetch()
+ *		   and appends them to the history.
+ *
+ * The stages are connected by bounded single-producer/single-consumer
+ * lock-free queues of preallocated buffers and batches, so a stalled read
+ * doesn't stall decoding and a backlog is caught up on three cores.
+ */
+
+#define INGEST_BUFFER_SIZE	(256 << 10)
+#define INGEST_BUFFERS		8
+#define INGEST_BATCHES		8
+#define INGEST_URING_DEPTH	4	/* reads in flight, < INGEST_BUFFERS */
+#define INGEST_SPINS		1000	/* before sleeping on an empty/full queue */
+#define INGEST_POLL_USECS	1000
+
+/* Initial load: the smallest range a worker is given */
+#define INGEST_LOAD_RANGE_MIN	(4 << 20)
+
+extern ssize_t  ingest_load_tail(int fd, const binlog_layout_t *layout, history_t *out, size_t records, size_t max_records, uint64_t *offset_p, uint64_t *first_p);
+extern ssize_t  ingest_load_before(int fd, const binlog_layout_t *layout, history_t *out, size_t max_records, uint64_t lo, uint64_t hi);
+extern int      ingest_start(int fd, uint64_t offset, const binlog_layout_t *layout, char stop_at_eof);
+extern int      ingest_fetch(history_t *p, uint64_t *ts_parse_p);
+extern int      ingest_fetch_timed(history_t *p, uint64_t *ts_parse_p, uint64_t usecs);
+extern void     ingest_set_stride(size_t stride);
+extern uint64_t ingest_position();
+extern void     ingest_stop();
+
+#endif
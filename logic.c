@@ -0,0 +1,269 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <cairo.h>
+
+#include "logic.h"
+#include "error.h"
+#include "malloc.h"
+
+uint32_t  logic_threshold[MAX_REAL_CHANNELS];
+uint64_t *logic_bits     [MAX_REAL_CHANNELS];
+uint64_t *logic_edges    [MAX_REAL_CHANNELS];
+uint64_t  logic_edges_count[MAX_REAL_CHANNELS];
+
+static char     logic_enabled[MAX_REAL_CHANNELS];
+static uint64_t logic_size    = 0;		/* records in the arrays	*/
+static uint64_t logic_indexed = 0;		/* records [0; indexed) are thresholded */
+
+static inline size_t logic_bits_bytes(uint64_t size) {
+	return (size + 63) / 64 * sizeof(uint64_t);
+}
+
+/*
+ * Parses "<channel>[:<threshold>]" and marks the channel as logic (may be
+ * given several times). Returns 0 on success.
+ */
+int logic_parse(char *spec) {
+	char *end;
+	long chan = strtol(spec, &end, 0);
+	uint32_t threshold = LOGIC_THRESHOLD_DEFAULT;
+
+	if (end == spec || chan < 0 || chan >= MAX_REAL_CHANNELS) {
+		error("Logic channel should be in [0; %u)", MAX_REAL_CHANNELS);
+		return EINVAL;
+	}
+
+	if (*end == ':') {
+		spec = end + 1;
+		threshold = strtoul(spec, &end, 0);
+		if (end == spec) {
+			error("Invalid logic threshold \"%s\"", spec);
+			return EINVAL;
+		}
+	}
+
+	if (*end) {
+		error("Unexpected \"%s\" in the logic channel", end);
+		return EINVAL;
+	}
+
+	logic_enabled  [chan] = 1;
+	logic_threshold[chan] = threshold;
+	return 0;
+}
+
+/* Returns the highest channel marked as logic by logic_parse(), -1 if none */
+int logic_channel_last() {
+	int chan = MAX_REAL_CHANNELS;
+
+	while (chan-- > 0)
+		if (logic_enabled[chan])
+			break;
+
+	return chan;
+}
+
+/* For the history of two halves of "size" records (see history_alloc()) */
+void logic_alloc(uint64_t size) {
+	int chan = 0;
+
+	logic_size = size * 2 + 1;
+	while (chan < MAX_REAL_CHANNELS) {
+		if (logic_enabled[chan]) {
+			// Lazily committed, the edges only cost as many pages as there're edges
+			logic_bits [chan] = mmap_malloc(logic_bits_bytes(logic_size), 0);
+			logic_edges[chan] = mmap_malloc(logic_size * sizeof(uint64_t), 0);
+		}
+		chan++;
+	}
+}
+
+void logic_free() {
+	int chan = 0;
+
+	while (chan < MAX_REAL_CHANNELS) {
+		if (logic_bits[chan] != NULL) {
+			mmap_free(logic_bits [chan], logic_bits_bytes(logic_size));
+			mmap_free(logic_edges[chan], logic_size * sizeof(uint64_t));
+			logic_bits [chan] = NULL;
+			logic_edges[chan] = NULL;
+		}
+		chan++;
+	}
+}
+
+/* Thresholds the records [indexed; history_length) */
+void logic_update() {
+	int chan = 0;
+
+	while (chan < MAX_REAL_CHANNELS) {
+		uint64_t *bits  = logic_bits [chan];
+		uint64_t *edges = logic_edges[chan];
+		uint64_t  count = logic_edges_count[chan];
+		uint64_t  i     = logic_indexed;
+		uint32_t  low   = logic_threshold[chan] > LOGIC_HYSTERESIS ? logic_threshold[chan] - LOGIC_HYSTERESIS : 0;
+		uint32_t  high  = logic_threshold[chan] + LOGIC_HYSTERESIS;
+		int       level;
+
+		if (bits == NULL) {
+			chan++;
+			continue;
+		}
+
+		level = i > 0 ? logic_level(chan, i - 1) : history[0].value[chan] >= logic_threshold[chan];
+
+		while (i < history_length) {
+			uint32_t value = history[i].value[chan];
+			uint64_t word  = bits[i / 64] & ~((uint64_t)1 << (i % 64));
+
+			if (unlikely(level ? value < low : value >= high)) {
+				level ^= 1;
+				edges[count++] = i;
+			}
+
+			__atomic_store_n(&bits[i / 64], word | (uint64_t)level << (i % 64), __ATOMIC_RELAXED);
+			i++;
+		}
+
+		__atomic_store_n(&logic_edges_count[chan], count, __ATOMIC_RELEASE);
+		chan++;
+	}
+
+	logic_indexed = history_length;
+}
+
+/* Forgets the index, history_flush() moved the records */
+void logic_reset() {
+	int chan = 0;
+
+	while (chan < MAX_REAL_CHANNELS) {
+		__atomic_store_n(&logic_edges_count[chan], 0, __ATOMIC_RELEASE);
+		chan++;
+	}
+	logic_indexed = 0;
+}
+
+/* The first of the "n" edges at or after "index" */
+static inline uint64_t logic_edge_lower_bound(int chan, uint64_t index, uint64_t n) {
+	const uint64_t *edges = logic_edges[chan];
+	uint64_t lo = 0;
+
+	while (lo < n) {
+		uint64_t mid = lo + (n - lo) / 2;
+
+		if (edges[mid] < index)
+			lo = mid + 1;
+		else
+			n = mid;
+	}
+
+	return lo;
+}
+
+/* Returns the first edge (a record with a new level) in (index; hi) or "hi" */
+uint64_t logic_edge_next(int chan, uint64_t index, uint64_t hi) {
+	uint64_t n = __atomic_load_n(&logic_edges_count[chan], __ATOMIC_ACQUIRE);
+	uint64_t e = logic_edge_lower_bound(chan, index + 1, n);
+
+	return e < n ? MIN(logic_edges[chan][e], hi) : hi;
+}
+
+/* The first edge in [lo; n) drawn at or after "x" */
+static uint64_t logic_edge_find_x(int chan, uint64_t lo, uint64_t n, const draw_transform_t *t, float x) {
+	const uint64_t *edges = logic_edges[chan];
+
+	while (lo < n) {
+		uint64_t mid = lo + (n - lo) / 2;
+
+		if (t->x_offset + t->x_scale * (float)(history[edges[mid]].timestamp - t->ts_start) < x)
+			lo = mid + 1;
+		else
+			n = mid;
+	}
+
+	return lo;
+}
+
+/* Adds the records [start; end) without gaps to the path, see logic_draw() */
+static void logic_draw_segment(cairo_t *cr, int chan, uint64_t start, uint64_t end, const draw_transform_t *t, const float y[2], uint64_t n) {
+	const uint64_t *edges = logic_edges[chan];
+	uint64_t e, e_end;
+	float x;
+	int level;
+
+	// Edges in (start; end)
+	e     = logic_edge_lower_bound(chan, start + 1, n);
+	e_end = logic_edge_lower_bound(chan, end, n);
+
+	level = logic_level(chan, start);
+	x     = t->x_offset + t->x_scale * (float)(history[start].timestamp - t->ts_start);
+
+	cairo_move_to(cr, x, y[level]);
+	while (e < e_end) {
+		uint64_t next;
+
+		x = t->x_offset + t->x_scale * (float)(history[edges[e]].timestamp - t->ts_start);
+		cairo_line_to(cr, x, y[level]);
+
+		// The edges drawn within this pixel column
+		next = logic_edge_find_x(chan, e + 1, e_end, t, floorf(x) + 1);
+		if (next - e > 1) {
+			cairo_line_to(cr, x, y[!level]);
+			cairo_line_to(cr, x, y[level]);
+		}
+		level ^= (next - e) & 1;
+		cairo_line_to(cr, x, y[level]);
+		e = next;
+	}
+	x = t->x_offset + t->x_scale * (float)(history[end - 1].timestamp - t->ts_start);
+	cairo_line_to(cr, x, y[level]);
+}
+
+/*
+ * Draws the records [start; end) of a logic channel as a square wave,
+ * broken at the gaps in the timestamps (see history_gap_next()). A pixel
+ * column with several edges is a vertical bar, found by a binary search,
+ * so the cost is O(min(edges, width * log(edges))).
+ */
+void logic_draw(cairo_t *cr, int chan, uint64_t start, uint64_t end, const draw_transform_t *t, const double color[3]) {
+	uint64_t n = __atomic_load_n(&logic_edges_count[chan], __ATOMIC_ACQUIRE);
+	float y[2];
+
+	if (start >= end)
+		return;
+
+	y[0] = t->y_offset[chan];
+	y[1] = t->y_offset[chan] - t->y_scale[chan] * LOGIC_HIGH_VALUE;
+
+	cairo_set_source_rgba(cr, color[0], color[1], color[2], 0.8);
+	while (start < end) {
+		uint64_t gap = history_gap_next(start, end);
+
+		logic_draw_segment(cr, chan, start, gap, t, y, n);
+		start = gap;
+	}
+	cairo_stroke(cr);
+}
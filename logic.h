@@ -0,0 +1,70 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_LOGIC_H
+#define __VOLTLOGGER_LOGIC_H
+
+#include <stdint.h>
+#include <cairo.h>
+
+#include "history.h"
+#include "draw.h"
+
+/*
+ * Logic channels (-D): digital status lines are thresholded (with
+ * hysteresis) as they are committed to the history, into a bit per record
+ * (next to the values, which stay in the history) and a run-length summary,
+ * the sorted indices of the records where the level changes. Drawing and
+ * edge search (logic_edge_next(), browsing from edge to edge) only visit the
+ * edges (or a binary search per pixel column where they're denser than
+ * that), not the samples.
+ *
+ * Like the timestamp runs, the index is private to the writer process and
+ * is rebuilt by history_flush(); readers validate what they've read with
+ * history_snapshot_valid().
+ */
+
+#define LOGIC_THRESHOLD_DEFAULT	(1 << (Y_BITS - 1))
+#define LOGIC_HYSTERESIS	(1 << (Y_BITS - 6))
+/* The value a logic "1" is drawn at */
+#define LOGIC_HIGH_VALUE	(1 << (Y_BITS - 2))
+
+extern uint32_t  logic_threshold[MAX_REAL_CHANNELS];
+extern uint64_t *logic_bits     [MAX_REAL_CHANNELS];	/* NULL if not a logic channel */
+extern uint64_t *logic_edges    [MAX_REAL_CHANNELS];
+extern uint64_t  logic_edges_count[MAX_REAL_CHANNELS];
+
+static inline int logic_channel(int chan) {
+	return logic_bits[chan] != NULL;
+}
+
+static inline int logic_level(int chan, uint64_t index) {
+	return (logic_bits[chan][index / 64] >> (index % 64)) & 1;
+}
+
+extern int      logic_parse(char *spec);
+extern int      logic_channel_last();
+extern void     logic_alloc(uint64_t size);
+extern void     logic_free();
+extern void     logic_update();
+extern void     logic_reset();
+extern uint64_t logic_edge_next(int chan, uint64_t index, uint64_t hi);
+extern void     logic_draw(cairo_t *cr, int chan, uint64_t start, uint64_t end, const draw_transform_t *t, const double color[3]);
+
+#endif
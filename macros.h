@@ -33,6 +33,12 @@
 #	endif
 #endif
 
+#if defined(__i386__) || defined(__x86_64__)
+#	define cpu_relax() __builtin_ia32_pause()
+#else
+#	define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
 #define TOSTR(a) # a
 #define XTOSTR(a) TOSTR(a)
 
@@ -24,44 +24,115 @@
 #include <stdlib.h>	/* free()	*/
 #include <string.h>
 #include <unistd.h>
-//#include <fcntl.h>
+#include <fcntl.h>
 #include <gtk/gtk.h>
 #include <pthread.h>
 #include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
 
 #include "configuration.h"
 #include "binary.h"
+#include "acquire.h"
+#include "autoset.h"
+#include "binlog.h"
+#include "columnar.h"
+#include "draw.h"
+#include "macros.h"
+#include "error.h"
+#include "filter.h"
+#include "history.h"
+#include "ingest.h"
+#include "logic.h"
+#include "raster.h"
+#include "replay.h"
+#include "server.h"
 #include "malloc.h"
+#include "pthreadex.h"
+#include "stats.h"
+#include "tilecache.h"
+#include "trigger.h"
+#include "xy.h"
 
 FILE *sensor;
 FILE *dump;
+uint64_t dump_ts_parse;		/* of the last fetched record */
 
-#define HISTORY_SIZE (1 << 20)
-#define MAX_REAL_CHANNELS 7
-#define MAX_MATH_CHANNELS 3
-#define Y_BITS 12
+/* oscilloscope.glade compiled in by glib-compile-resources (see GNUmakefile) */
+#define GLADE_RESOURCE "/org/voltlogger/oscilloscope/oscilloscope.glade"
 
-#define GLADE_PATH "oscilloscope.glade"
-
-typedef struct {
-	uint64_t timestamp;
-	uint32_t value[MAX_REAL_CHANNELS];
-} history_t;
+/* How often (in records) the fetcher updates the backlog gauge */
+#define BACKLOG_CHECK_RECORDS 4096
 
 int running = 1;
 
+// The fetcher thread feeds the trigger engine, otherwise cb_draw() does (see trigger_catch_up())
+char fetching = 0;
+
+// Replaying a recording (-r) paced by replay_pace() instead of following a live file
+char replaying = 0;
+
+/*
+ * Overload policy (-O): when the fetcher is more than OVERLOAD_BACKLOG_HIGH
+ * bytes behind the writer, it stores only one of "overload_factor" records
+ * (seeking over the rest) or the min/max envelope of them, until the
+ * backlog is below OVERLOAD_BACKLOG_LOW.
+ */
+enum overload_mode {
+	OVERLOAD_NONE = 0,
+	OVERLOAD_SKIP,
+	OVERLOAD_MINMAX,
+};
+
+int  overload_mode   = OVERLOAD_NONE;
+int  overload_factor = OVERLOAD_FACTOR_DEFAULT;
+char overloaded      = 0;
+
+binlog_layout_t dumplayout;
+
+// A thin client of a frame server (-c): frames come from it instead of the history
+int remote_fd = -1;
+const char *remote_address;
+
+// The last frame of the server, fetched by update() so a stalled network doesn't freeze the UI
+pthread_mutex_t remote_mutex = PTHREAD_MUTEX_INITIALIZER;
+server_frame_t  remote_frame;
+server_column_t remote_columns[SERVER_COLUMNS_MAX * MAX_REAL_CHANNELS];
+int             remote_width = 1;
+pthread_lockstat_t remote_fetch_lockstat = PTHREAD_LOCKSTAT_INITIALIZER("remote_fetch");
+pthread_lockstat_t remote_draw_lockstat  = PTHREAD_LOCKSTAT_INITIALIZER("remote_draw");
+
+// Progressive open (see history_backfill()): [from; to) of the input is left to load
+char       backfilling = 0;
+uint64_t   backfill_from;
+uint64_t   backfill_to;
+pthread_t  backfill_thread;
+history_t *backfill_rows;
+uint64_t   backfill_records;
+uint64_t   backfill_ts_next;	/* of history[0] when the backfill started */
+ssize_t    backfill_loaded;
+char       backfill_done = 0;	/* set by the backfill thread, taken by the fetcher */
+
 
 GtkBuilder *builder;
-history_t  *history;
-uint32_t    history_length = 0;
 uint64_t    ts_global = 0;
 
-pthread_mutex_t history_mutex;
+float  *draw_x = NULL;
+float  *draw_y[MAX_REAL_CHANNELS];
+size_t  draw_capacity = 0;
 
-enum trigger_mode {
-	TG_RISE,
-	TG_FALL,
-};
+// Browsing the history (see cb_button_press()): absolute position and zoom instead of following the trigger
+char     browsing = 0;
+int      browse_zoom;
+uint64_t browse_ts_start;
+double   browse_drag_x;
+uint64_t browse_drag_ts;
+uint64_t frame_ts_start = 0;
+uint64_t frame_ts_end   = 0;
+
+cairo_pattern_t *last_frame = NULL;
+int              last_frame_width;
+int              last_frame_height;
 
 double x_userdiv    = 0.95E-3;
 double x_useroffset = 0;
@@ -70,12 +141,6 @@ double y_useroffset[MAX_REAL_CHANNELS + MAX_MATH_CHANNELS];
 
 char   chanenabled[MAX_REAL_CHANNELS + MAX_MATH_CHANNELS];
 
-int trigger_channel	= 0;
-int trigger_start_mode	= TG_RISE;
-int trigger_start_y	= 675;
-int trigger_end_mode	= TG_RISE;
-int trigger_end_y	= 675;
-
 int channelsNum		= 1;
 int mathChannelsNum	= 0;
 
@@ -149,74 +214,283 @@ dump_open(char *dumppath, char tailonly)
 	return;
 }
 
-int
+/* The records are read and decoded by the ingest pipeline (see ingest.h) */
+static inline int
 dump_fetch(history_t *p)
 {
-	uint64_t ts_parse;
-	uint64_t ts_device;
-	uint32_t value;
+	return ingest_fetch(p, &dump_ts_parse);
+}
+
+/* Returns -1 if there's no record within "usecs" */
+static inline int
+dump_fetch_timed(history_t *p, uint64_t usecs)
+{
+	return ingest_fetch_timed(p, &dump_ts_parse, usecs);
+}
 
-	ts_parse  = get_uint64(dump);
-	while (ts_parse < 1437900000000000000 || ts_parse > 1537900000000000000) {
-		printf("dump_fetch() correction 0: %lu %li\n", ts_parse, ftell(dump));
-		get_uint8(dump);
-		ts_parse = get_uint64(dump);
+void
+dump_close()
+{
+	return;
+}
+
+/* Returns how many bytes the fetcher is behind the writer (0 if unknown) */
+uint64_t
+dump_update_backlog()
+{
+	struct stat st;
+	uint64_t pos;
+	uint64_t backlog;
+
+	if (fstat(fileno(dump), &st) || !S_ISREG(st.st_mode))
+		return 0;
+
+	pos = ingest_position();
+
+	backlog = st.st_size > pos ? st.st_size - pos : 0;
+	stats_set(STATS_BACKLOG_BYTES, backlog);
+	return backlog;
+}
+
+/* Parses "skip[:factor]" or "minmax[:factor]" */
+int
+overload_parse(char *arg)
+{
+	char *factor = strchr(arg, ':');
+
+	if (factor != NULL) {
+		*factor++ = 0;
+		overload_factor = atoi(factor);
+		if (overload_factor < 2) {
+			fprintf(stderr, "Decimation factor should be at least 2\n");
+			return -1;
+		}
 	}
 
-	ts_device = get_uint64(dump);
+	if (!strcmp(arg, "skip"))
+		overload_mode = OVERLOAD_SKIP;
+	else if (!strcmp(arg, "minmax"))
+		overload_mode = OVERLOAD_MINMAX;
+	else {
+		fprintf(stderr, "Unknown overload mode \"%s\"\n", arg);
+		return -1;
+	}
 
-	int i = 0;
-	while (i < channelsNum) {
-		p->value[i] = get_uint32(dump);
-		while (value < 0 || value > 1024) {
-			printf("dump_fetch() correction 1\n");
-			p->value[i] = get_uint32(dump);
+	return 0;
+}
+
+void
+overload_check(uint64_t backlog)
+{
+	if (!overloaded && backlog > OVERLOAD_BACKLOG_HIGH) {
+		info("Overload: %lu bytes behind, decimating by %i", backlog, overload_factor);
+		stats_inc(STATS_OVERLOADS, 1);
+		overloaded = 1;
+		history_decimation = overload_factor;
+		// Skipping is done by the decoder, it jumps over the records instead of decoding them
+		if (overload_mode == OVERLOAD_SKIP)
+			ingest_set_stride(overload_factor);
+	} else if (overloaded && backlog < OVERLOAD_BACKLOG_LOW) {
+		info("Overload is over");
+		overloaded = 0;
+		history_decimation = 1;
+		ingest_set_stride(1);
+	}
+
+	return;
+}
+
+/*
+ * Fetches "overload_factor" records and reduces them into "out" (the two
+ * records of OVERLOAD_MINMAX). Returns the number of records in "out" (0
+ * if the input is over). OVERLOAD_SKIP doesn't get here: the decoder
+ * skips (see overload_check()).
+ */
+int
+overload_fetch(history_t *out)
+{
+	history_t rec;
+	uint32_t min[MAX_REAL_CHANNELS], max[MAX_REAL_CHANNELS];
+	int      min_at[MAX_REAL_CHANNELS], max_at[MAX_REAL_CHANNELS];
+	int i, chan;
+
+	// Evenly spaced pairs, the earlier extreme of every channel goes first
+	i = 0;
+	while (i < overload_factor) {
+		if (!dump_fetch(&rec))
+			return 0;
+
+		if (i == 0)
+			out[0].timestamp = rec.timestamp;
+		if (i == overload_factor / 2)
+			out[1].timestamp = rec.timestamp;
+
+		chan = 0;
+		while (chan < channelsNum) {
+			if (i == 0 || rec.value[chan] < min[chan]) {
+				min   [chan] = rec.value[chan];
+				min_at[chan] = i;
+			}
+			if (i == 0 || rec.value[chan] > max[chan]) {
+				max   [chan] = rec.value[chan];
+				max_at[chan] = i;
+			}
+			chan++;
 		}
 		i++;
 	}
 
-	(void)ts_parse;
-	p->timestamp = ts_device;
+	chan = 0;
+	while (chan < channelsNum) {
+		char min_first = min_at[chan] <= max_at[chan];
+
+		out[0].value[chan] = min_first ? min[chan] : max[chan];
+		out[1].value[chan] = min_first ? max[chan] : min[chan];
+		chan++;
+	}
 
-	//fprintf(stderr, "%u\n", p->value[0]);
+	stats_inc(STATS_DECIMATED_RECORDS, overload_factor - 2);
+	return 2;
+}
 
-	//sleep(1);
+/* Passes a record to everything following the stream (trigger, autoset, XY, acquisition) */
+static inline void
+record_feed(const history_t *p)
+{
+	int triggered = trigger_feed(p);
 
-	return 1;
+	autoset_feed(p);
+	if (xy_enabled)
+		xy_feed(p);
+	if (acquire_enabled)
+		acquire_feed(p, triggered);
 }
 
-void
-dump_close()
+/* The record at history_length-1 is filled: publishes it */
+static inline void
+history_fetched()
 {
-	return;
+	record_feed(&history[ history_length-1 ]);
+	//printf("%lu; %u\n", history[ history_length-1].timestamp, history[ history_length-1].value[0]);
+	history_commit();
+	if (history_length >= history_size * 2)
+		history_flush();
 }
 
-void
-history_flush()
+/*
+ * Second phase of a progressive open: the first frame is drawn from the
+ * last screenful of the input while the rest of the history is decoded
+ * (on all the cores) by this thread, so the fetcher follows the input
+ * meanwhile. The fetcher, the only writer of the history, puts the
+ * records in front of it (see history_backfilled()). The backfilled
+ * records aren't fed to the trigger, its state already follows the newer
+ * ones.
+ */
+static void *
+history_backfill(void *arg)
 {
-	//sleep(3600);
-	pthread_mutex_lock(&history_mutex);
-	memcpy(history, &history[HISTORY_SIZE], sizeof(*history)*HISTORY_SIZE);
-	history_length = HISTORY_SIZE;
+	uint64_t ts_start = stats_now();
 
-	printf("history_flush()\n");
-	pthread_mutex_unlock(&history_mutex);
-	return;
+	backfill_loaded = ingest_load_before(fileno(dump), &dumplayout, backfill_rows, backfill_records, backfill_from, backfill_to);
+	info("Backfilled %li records in %lu ms", backfill_loaded, (stats_now() - ts_start) / 1000000);
+
+	__atomic_store_n(&backfill_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Called by the fetcher once history_backfill() is done (or at the end of
+ * the input). If history_flush() has dropped the records the backfill
+ * continues into meanwhile, it's dropped too: prepending it would leave a
+ * hole, taken for lost samples.
+ */
+static void
+history_backfilled()
+{
+	pthread_join(backfill_thread, NULL);
+	if (backfill_loaded > 0 && history_length > 0 && history[0].timestamp == backfill_ts_next)
+		history_prepend(backfill_rows, backfill_loaded);
+	else if (backfill_loaded > 0)
+		info("The history has moved on while backfilling, dropped the backfill");
+
+	free(backfill_rows);
+	backfilling = 0;
 }
 
 void *
 history_fetcher(void *arg)
 {
 	//fprintf(stderr, "history_fetcher\n");
+	if (backfilling) {
+		backfill_records = history_size * 2 - 1 - history_length;
+		backfill_ts_next = history[0].timestamp;
+		backfill_rows    = xmalloc(sizeof(*backfill_rows) * backfill_records);
+		if (pthread_create(&backfill_thread, NULL, history_backfill, NULL)) {
+			error("Cannot create the backfill thread");
+			free(backfill_rows);
+			backfilling = 0;
+		}
+	}
+
+	uint64_t records      = history_length;	/* including the initial load */
+	uint64_t backlog_next = records + BACKLOG_CHECK_RECORDS;
 
 	while (running) {
-		//sensor_fetch(&history[0][ history_length[0]++ ]);
-		dump_fetch(&history[ history_length++ ]);
-		//printf("%lu; %u\n", history[ history_length-1].timestamp, history[ history_length-1].value[0]);
-		if (history_length >= HISTORY_SIZE * 2) 
-			history_flush();
+		if (unlikely(backfilling) && __atomic_load_n(&backfill_done, __ATOMIC_ACQUIRE))
+			history_backfilled();
+
+		if (likely(!overloaded) || overload_mode == OVERLOAD_SKIP) {
+			int rc;
+
+			// While backfilling, an idle input must not delay putting the backfill in front
+			//sensor_fetch(&history[0][ history_length[0]++ ]);
+			if (unlikely(backfilling))
+				rc = dump_fetch_timed(&history[ history_length ], AUTOUPDATE_USECS);
+			else
+				rc = dump_fetch(&history[ history_length ]);
+			if (rc < 0)
+				continue;
+			if (!rc)
+				break;
+			history_length++;
+			if (unlikely(replaying))
+				replay_pace(dump_ts_parse);
+			history_fetched();
+			records++;
+		} else {
+			history_t reduced[2];
+			int n = overload_fetch(reduced);
+			int i = 0;
+
+			if (!n)
+				break;
+			if (unlikely(replaying))
+				replay_pace(dump_ts_parse);
+			while (i < n) {
+				history[ history_length++ ] = reduced[i++];
+				history_fetched();
+			}
+			records += overload_factor;
+		}
+
+		if (records >= backlog_next) {
+			uint64_t backlog = dump_update_backlog();
+
+			if (overload_mode != OVERLOAD_NONE)
+				overload_check(backlog);
+			stats_set(STATS_RECORDS, records);
+			backlog_next = records + BACKLOG_CHECK_RECORDS;
+		}
 	}
 
+	if (backfilling)
+		history_backfilled();
+
+	// A replay ends with the recording instead of waiting for more
+	if (replaying && running)
+		replay_report();
+
+	stats_set(STATS_RECORDS, records);
 	return NULL;
 }
 
@@ -252,6 +526,83 @@ arrange_widgets()
 	return;
 }
 
+/*
+ * Fits every channel to the screen by its value histogram, sets the trigger
+ * level to the middle of the trigger channel and the timebase to
+ * AUTOSET_PERIODS of its periods (see autoset.h). Returns 0 if there
+ * wasn't enough data yet.
+ */
+static int
+autoset_apply()
+{
+	char offsetwidgetname[] = "offset_chanX";
+	char scalewidgetname[]  = "scale_chanX";
+	autoset_result_t t, r;
+	int chan = 0;
+
+	if (!autoset_get(trigger_config.channel, &t))
+		return 0;
+
+	switch (trigger_config.mode) {
+		case TRIGGER_EDGE:
+		case TRIGGER_PULSE:
+			__atomic_store_n(&trigger_config.level, t.mid, __ATOMIC_RELAXED);
+			break;
+		case TRIGGER_WINDOW:
+		case TRIGGER_RUNT:
+			__atomic_store_n(&trigger_config.level,      t.lo + (t.hi - t.lo) / 4, __ATOMIC_RELAXED);
+			__atomic_store_n(&trigger_config.level_high, t.hi - (t.hi - t.lo) / 4, __ATOMIC_RELAXED);
+			break;
+	}
+	__atomic_store_n(&trigger_config.hysteresis, (t.hi - t.lo) / 16, __ATOMIC_RELAXED);
+
+	if (t.period > 0)
+		x_userdiv = MIN(AUTOSET_PERIODS * t.period / history_size, 1);
+
+	while (chan < channelsNum) {
+		if (autoset_get(chan, &r)) {
+			double scale  = MAX(MIN(AUTOSET_SCREEN_FRACTION * (1 << Y_BITS) / (r.hi - r.lo), 10), 1);
+			double offset = (double)r.mid / (1 << Y_BITS);
+
+			// The sliders' callbacks update y_userscale[] and y_useroffset[]
+			offsetwidgetname[11] = chan + '0';
+			scalewidgetname [10] = chan + '0';
+			GObject *offset_widget = gtk_builder_get_object(builder, offsetwidgetname);
+			GObject *scale_widget  = gtk_builder_get_object(builder, scalewidgetname);
+			y_useroffset[chan] = offset;
+			y_userscale [chan] = scale;
+			if (offset_widget != NULL)
+				gtk_range_set_value(GTK_RANGE(offset_widget), offset);
+			if (scale_widget != NULL)
+				gtk_range_set_value(GTK_RANGE(scale_widget), scale);
+		}
+		chan++;
+	}
+
+	browsing = 0;
+	info("Autoset: trigger level %u, %.1f records per period", trigger_config.level, t.period);
+	return 1;
+}
+
+static void
+cb_autoset(GtkWidget *button, gpointer area)
+{
+	if (!autoset_apply())
+		warning("Not enough data for the autoset yet");
+	gtk_widget_queue_draw(area);
+}
+
+// -A: retried until there's enough data
+static gboolean
+cb_autoset_pending(gpointer area)
+{
+	if (!autoset_apply())
+		return TRUE;
+
+	gtk_widget_queue_draw(area);
+	return FALSE;
+}
+
 void
 cb_chanenable_toggled (
 		GtkToggleButton *button,
@@ -313,12 +664,190 @@ cb_resize (
 	printf("%d, %d\n", width, height);
 }
 
+/*
+ * Without the local fetcher (a columnar file or an attached shared store)
+ * the trigger engine (and the XY accumulator) is fed here with the records
+ * appeared since the last frame
+ */
+static void
+trigger_catch_up(history_snapshot_t *view)
+{
+	static uint64_t ts_fed = 0;
+	uint64_t i = 0;
+
+	if (view->length == 0)
+		return;
+
+	if (ts_fed)
+		i = history_find(ts_fed + 1, 0, view->length);
+
+	while (i < view->length)
+		record_feed(&history[i++]);
+
+	ts_fed = history[view->length - 1].timestamp;
+	return;
+}
+
+/*
+ * Thin client: gets the per-column min/max of the frame server, for the
+ * live window or the browsed range, into remote_frame and remote_columns.
+ */
+static void
+remote_fetch()
+{
+	static server_column_t columns[SERVER_COLUMNS_MAX * MAX_REAL_CHANNELS];
+	server_frame_t frame;
+	int width = remote_width;
+	int rc;
+
+	if (browsing)
+		rc = server_request_frame(remote_fd, SERVER_FRAME_RANGE, width, browse_ts_start, browse_ts_start + ((uint64_t)width << browse_zoom), &frame, columns);
+	else
+		rc = server_request_frame(remote_fd, SERVER_FRAME_LIVE, width, history_size*x_userdiv, 0, &frame, columns);
+
+	if (rc) {
+		int fd;
+
+		// After a timeout the stream is out of sync: replace the connection, keeping the descriptor
+		warning_ratelimited("Cannot get a frame from the server, reconnecting");
+		fd = server_connect(remote_address);
+		if (fd != -1) {
+			dup2(fd, remote_fd);
+			fcntl(remote_fd, F_SETFD, FD_CLOEXEC);
+			close(fd);
+		}
+		return;
+	}
+
+	pthread_mutex_lock_stat(&remote_mutex, &remote_fetch_lockstat);
+	remote_frame = frame;
+	memcpy(remote_columns, columns, (size_t)frame.columns * frame.channels * sizeof(*columns));
+	pthread_mutex_unlock_stat(&remote_mutex, &remote_fetch_lockstat);
+}
+
+/* Draws the last frame fetched by remote_fetch(). Returns 0 if there's nothing to draw */
+static int
+remote_draw(cairo_t *cr, int width, int height)
+{
+	const server_column_t *columns = remote_columns;
+	server_frame_t frame;
+	double y_scale = (double)height / (1 << Y_BITS);
+	int chan;
+
+	remote_width = width;
+
+	pthread_mutex_lock_stat(&remote_mutex, &remote_draw_lockstat);
+	frame = remote_frame;
+	if (frame.columns == 0) {
+		pthread_mutex_unlock_stat(&remote_mutex, &remote_draw_lockstat);
+		return 0;
+	}
+
+	if (!browsing) {
+		frame_ts_start = frame.ts_start;
+		frame_ts_end   = frame.ts_end;
+	}
+
+	chan = 0;
+	while (chan < frame.channels) {
+		double y_offset = (double)height/2 + (double)y_useroffset[chan]*y_userscale[chan]*height;
+		double y_mul    = y_scale * y_userscale[chan];
+		int col = 0;
+
+		if (!chanenabled[chan]) {
+			chan++;
+			continue;
+		}
+
+		cairo_set_source_rgba (cr, line_colors[chan][0], line_colors[chan][1], line_colors[chan][2], 0.8);
+		cairo_new_path(cr);
+		while (col < frame.columns) {
+			const server_column_t *c = &columns[col * frame.channels + chan];
+			double x = (col + 0.5) * width / frame.columns;
+
+			if (c->min <= c->max) {
+				cairo_line_to(cr, x, y_offset - y_mul * c->min);
+				cairo_line_to(cr, x, y_offset - y_mul * c->max);
+			}
+			col++;
+		}
+		cairo_stroke(cr);
+		chan++;
+	}
+
+	pthread_mutex_unlock_stat(&remote_mutex, &remote_draw_lockstat);
+	return 1;
+}
+
+/*
+ * Draws the last sweep of the averaging/hires acquisition (see acquire.h)
+ * instead of the raw trigger-aligned window. Returns 0 if there's no
+ * sweep yet.
+ */
+static int
+acquired_draw(cairo_t *cr, int width, int height)
+{
+	static history_t sweep[ACQUIRE_POINTS_MAX];
+	static float     x[ACQUIRE_POINTS_MAX];
+	static float     y[MAX_REAL_CHANNELS][ACQUIRE_POINTS_MAX];
+	float  *y_chans[MAX_REAL_CHANNELS];
+	double  y_scale = (double)height / (1 << (Y_BITS + ACQUIRE_FRACTION_BITS));
+	draw_transform_t t;
+	size_t count;
+	int chan;
+
+	// Sweeps as long as the live window
+	acquire_set_length(history_size*x_userdiv);
+
+	count = acquire_read(sweep);
+	if (count < 2 || sweep[count - 1].timestamp == sweep[0].timestamp)
+		return 0;
+
+	frame_ts_start = sweep[0].timestamp;
+	frame_ts_end   = sweep[count - 1].timestamp;
+
+	t.ts_start = frame_ts_start;
+	t.x_offset = x_useroffset*width;
+	t.x_scale  = (double)width / (frame_ts_end - frame_ts_start);
+	chan = 0;
+	while (chan < MAX_REAL_CHANNELS) {
+		t.y_offset[chan] = (double)height/2 + (double)y_useroffset[chan]*y_userscale[chan]*height;
+		t.y_scale [chan] = y_scale * y_userscale[chan];
+		y_chans   [chan] = y[chan];
+		chan++;
+	}
+
+	draw_kernel(sweep, count, &t, x, y_chans);
+
+	chan = 0;
+	while (chan < channelsNum) {
+		size_t i = 0;
+
+		if (!chanenabled[chan]) {
+			chan++;
+			continue;
+		}
+
+		cairo_set_source_rgba (cr, line_colors[chan][0], line_colors[chan][1], line_colors[chan][2], 0.8);
+		cairo_new_path(cr);
+		while (i < count) {
+			cairo_line_to(cr, x[i], y[chan][i]);
+			i++;
+		}
+		cairo_stroke(cr);
+		chan++;
+	}
+
+	return 1;
+}
+
 static gboolean
 cb_draw (GtkWidget	*area,
          cairo_t	*cr,
          gpointer	*data)
 {
 	int width, height;
+	uint64_t ts_draw = stats_now();
 
 	GdkWindow *areaGdkWindow = gtk_widget_get_window(area);
 
@@ -330,122 +859,179 @@ cb_draw (GtkWidget	*area,
 
 	//fprintf(stderr, "%i %i\n", width, height);
 
+	history_snapshot_t view = {0};
+	char consistent = remote_fd != -1 || history_snapshot(&view);
+	int history_end = view.length-2;
+
+	if (consistent && !fetching && remote_fd == -1)
+		trigger_catch_up(&view);
+
+	cairo_push_group(cr);
+
 	cairo_rectangle(cr, 0, 0, width, height);
 	cairo_set_source_rgb(cr, 0, 0, 0);
 	cairo_fill(cr);
 
 	cairo_set_line_width (cr, 2);
 
-	int history_end   = history_length-2;
+	if (remote_fd != -1) {
+		consistent = remote_draw(cr, width, height);
+	} else if (consistent && xy_enabled) {
+		xy_draw(cr, width, height, line_colors[xy_config.y]);
+	} else if (consistent && browsing) {
+		tilecache_view_t tv;
+		double y_scale = (double)height / (1 << Y_BITS);
+		int chan = 0;
+
+		tv.zoom     = browse_zoom;
+		tv.ts_start = browse_ts_start;
+		tv.width    = width;
+		tv.height   = height;
+		tv.channels = channelsNum;
+		while (chan < channelsNum) {
+			tv.enabled [chan] = chanenabled[chan];
+			tv.y_offset[chan] = (double)height/2 + (double)y_useroffset[chan]*y_userscale[chan]*height;
+			tv.y_scale [chan] = y_scale * y_userscale[chan];
+			memcpy(tv.color[chan], line_colors[chan], sizeof(tv.color[chan]));
+			chan++;
+		}
 
-	if (history_end >= (double)HISTORY_SIZE*x_userdiv) {
-		//printf("%u %u\n", HISTORY_SIZE, history_end);
-		pthread_mutex_lock(&history_mutex);
+		consistent = tilecache_draw(cr, &tv, &view);
+	} else if (consistent && acquire_enabled) {
+		consistent = acquired_draw(cr, width, height);
+	} else if (consistent && history_end > 0) {
+		//printf("%u %u\n", history_size, history_end);
 		//cairo_set_source_rgba (cr, 0, 0, 0.3, 0.8);
 		//cairo_set_source_rgba (cr, 0.8, 0.8, 1, 0.8);
 		int x;
 		int y;
 
-		//int history_start = history_end - HISTORY_SIZE;
-		int history_start_initial = history_end - (double)HISTORY_SIZE*x_userdiv;
-		int history_start = history_start_initial;
-
-		if (history_start == 0)
-			history_start++;
-
-		//printf("h: %u %u\n", history_start, history_end);
-
-		char found;
-
-		found = 0;
-		while (history_start < history_end && !found) {
-			history_t *cur  = &history[history_start];
-			history_t *prev = &history[history_start-1];
-			//printf("1 %u %u\n", cur->value, prev->value);
-			switch (trigger_start_mode) {
-				case TG_FALL:
-					found = (cur->value[trigger_channel] >= trigger_start_y && prev->value[trigger_channel] <  trigger_start_y);
-					break;
-				case TG_RISE:
-					found = (cur->value[trigger_channel] <  trigger_start_y && prev->value[trigger_channel] >= trigger_start_y);
-					break;
-			}
+		// Until the history holds a whole window (e.g. a short input), draw what there is
+		int history_start = MAX(history_end - (double)history_size*x_userdiv, 0);
+		uint64_t ts_trigger = stats_now();
+		uint64_t ts_first, ts_last;
+
+		// Show whole periods: from the first to the last trigger event within the window
+		if (trigger_find(history[history_start].timestamp, history[history_end].timestamp, &ts_first, &ts_last)) {
+			history_start = history_find(ts_first, history_start, history_end);
+			if (ts_last > ts_first)
+				history_end = history_find(ts_last, history_start, history_end);
+		} else {
+			warning_ratelimited("No trigger events to sync on");
+			stats_inc(STATS_SYNC_FAILURES, 1);
+		}
+		stats_time(STATS_H_TRIGGER, ts_trigger);
 
-			if (found)
-				break;
+		//printf("H: %u %u\n", history_start, history_end);
 
-			history_start++;
-		}
+		uint64_t timestamp_start = history[history_start].timestamp;
+		uint64_t timestamp_end   = history[history_end  ].timestamp;
 
-		if (history_start >= history_end) {
-			printf("Unable to sync start\n");
-			history_start = history_start_initial;
+		if (timestamp_start == timestamp_end) {
+			warning_ratelimited("%lu %lu %u %u %u %u", timestamp_start, timestamp_end, history_start, history_end, history[history_start].value[0], history[history_end].value[0]);
+			consistent = 0;
+			goto l_draw_end;
 		}
 
-		int history_end_initial = history_end;
-		history_end--;
-
-		found = 0;
-		while (history_start < history_end && !found) {
-			history_t *cur  = &history[history_end];
-			history_t *prev = &history[history_end+1];
-			//printf("2 %u %u\n", cur->value, prev->value);
-			switch (trigger_end_mode) {
-				case TG_RISE:
-					found = (cur->value[trigger_channel] >= trigger_end_y && prev->value[trigger_channel] <  trigger_end_y);
-					break;
-				case TG_FALL:
-					found = (cur->value[trigger_channel] <  trigger_end_y && prev->value[trigger_channel] >= trigger_end_y);
-					break;
-			}
+		frame_ts_start = timestamp_start;
+		frame_ts_end   = timestamp_end;
 
-			if (found)
-				break;
+		double x_scale = (double)width  / (timestamp_end - timestamp_start);
+		double y_scale = (double)height / (1 << Y_BITS);
 
-			history_end--;
-		}
+		size_t count = history_end - history_start;
+		draw_transform_t t;
+		int chan;
 
-		if (history_start >= history_end) {
-			printf("Unable to sync end\n");
-			history_end = history_end_initial;
+		t.ts_start = timestamp_start;
+		t.x_offset = x_useroffset*width;
+		t.x_scale  = x_scale;
+		chan = 0;
+		while (chan < channelsNum) {
+			t.y_offset[chan] = (double)height/2 + (double)y_useroffset[chan]*y_userscale[chan]*height;
+			t.y_scale [chan] = y_scale * y_userscale[chan];
+			chan++;
 		}
 
-		//printf("H: %u %u\n", history_start, history_end);
+		// Dense trace: several samples per pixel column, rasterize directly
+		if (count >= (size_t)width * RASTER_MIN_SAMPLES_PER_PX) {
+			raster_t *r = raster_get(width, height);
+			raster_trace_t rt;
+
+			rt.ts_start = timestamp_start;
+			rt.ts_span  = timestamp_end - timestamp_start;
+			rt.x_offset = x_useroffset*width;
+			rt.alpha    = 0.8;
+			chan = 0;
+			while (chan < channelsNum) {
+				if (chanenabled[chan] && !logic_channel(chan)) {
+					rt.y_offset = (double)height/2 + (double)y_useroffset[chan]*y_userscale[chan]*height;
+					rt.y_scale  = y_scale * y_userscale[chan];
+					memcpy(rt.color, line_colors[chan], sizeof(rt.color));
+
+					// Separate traces for the segments between the gaps
+					uint64_t seg_start = history_start;
+					while (seg_start < history_end) {
+						uint64_t seg_end = history_gap_next(seg_start, history_end);
+						raster_trace(r, &history[seg_start], seg_end - seg_start, chan, &rt);
+						seg_start = seg_end;
+					}
+				}
+				chan++;
+			}
 
-		uint64_t timestamp_start = history[history_start].timestamp;
-		uint64_t timestamp_end   = history[history_end  ].timestamp;
+			cairo_set_source_surface(cr, raster_surface(r), 0, 0);
+			cairo_paint(cr);
+			goto l_draw_math;
+		}
 
-		if (timestamp_start == timestamp_end) {
-			printf("%lu %lu %u %u %u %u\n", timestamp_start, timestamp_end, history_start, history_end, history[history_start].value[0], history[history_end].value[0]);
+		if (count > draw_capacity) {
+			draw_x = xrealloc(draw_x, count * sizeof(*draw_x));
+			chan = 0;
+			while (chan < MAX_REAL_CHANNELS) {
+				draw_y[chan] = xrealloc(draw_y[chan], count * sizeof(*draw_y[chan]));
+				chan++;
+			}
+			draw_capacity = count;
 		}
-		assert (timestamp_end != timestamp_start);
 
-		double x_scale = (double)width  / (timestamp_end - timestamp_start);
-		double y_scale = (double)height / (1 << Y_BITS);
+		draw_kernel(&history[history_start], count, &t, draw_x, draw_y);
 
-		int chan = 0;
+		chan = 0;
 		while (chan < channelsNum) {
-			if (!chanenabled[chan]) {
+			if (!chanenabled[chan] || logic_channel(chan)) {
 				chan++;
 				continue;
 			}
 
-			int history_cur = history_start;
+			float *y_chan = draw_y[chan];
+			size_t i = 0;
+			size_t gap = history_gap_next(history_start, history_end) - history_start;
 			cairo_set_source_rgba (cr, line_colors[chan][0], line_colors[chan][1], line_colors[chan][2], 0.8);
 			cairo_move_to(cr, -1, height/2);
-			while (history_cur < history_end) {
-				history_t *p = &history[ history_cur++ ];
-
-				x = (double)x_useroffset*width              + (double)x_scale               * (double)(p->timestamp - timestamp_start);
-				y = (double)height/2 + (double)y_useroffset[chan]*y_userscale[chan]*height - (double)y_scale * y_userscale[chan] * (double) p->value[chan];
-				cairo_line_to(cr, x, y);
-				//printf("xy: %u (%lu %e) %u (%u %e %e)\n", x, p->timestamp - timestamp_start, x_scale, y, p->value, y_scale, y_userscale);
+			while (i < count) {
+				// Don't draw across the lost samples
+				if (unlikely(i == gap)) {
+					cairo_move_to(cr, draw_x[i], y_chan[i]);
+					gap = history_gap_next(history_start + i, history_end) - history_start;
+				} else
+					cairo_line_to(cr, draw_x[i], y_chan[i]);
+				i++;
 			}
 			cairo_stroke(cr);
 
 			chan++;
 		}
 
+l_draw_math:
+		// Logic channels are drawn from their edges, not the samples
+		chan = 0;
+		while (chan < channelsNum) {
+			if (chanenabled[chan] && logic_channel(chan))
+				logic_draw(cr, chan, history_start, history_end, &t, line_colors[chan]);
+			chan++;
+		}
+
 		chan = 0;
 		while (chan < mathChannelsNum) {
 			int history_cur = history_start;
@@ -463,7 +1049,9 @@ cb_draw (GtkWidget	*area,
 
 			chan++;
 		}
-		pthread_mutex_unlock(&history_mutex);
+l_draw_end:
+		// history_flush() moved the records while we were reading them
+		consistent &= history_snapshot_valid(&view);
 	}
 
 	//cairo_set_source_rgba (cr, 0, 0, 0, 0.2);
@@ -472,6 +1060,157 @@ cb_draw (GtkWidget	*area,
 	cairo_line_to(cr, width, height/2);
 	cairo_stroke(cr);
 
+	cairo_pattern_t *frame = cairo_pop_group(cr);
+
+	if (!consistent && last_frame != NULL && last_frame_width == width && last_frame_height == height) {
+		cairo_pattern_destroy(frame);
+		cairo_set_source(cr, last_frame);
+		cairo_paint(cr);
+		stats_inc(STATS_FRAMES_REUSED, 1);
+		stats_time(STATS_H_DRAW, ts_draw);
+		return TRUE;
+	}
+
+	if (last_frame != NULL)
+		cairo_pattern_destroy(last_frame);
+	last_frame        = frame;
+	last_frame_width  = width;
+	last_frame_height = height;
+	cairo_set_source(cr, last_frame);
+	cairo_paint(cr);
+
+	stats_inc(STATS_FRAMES, 1);
+	stats_time(STATS_H_DRAW, ts_draw);
+	return TRUE;
+}
+
+static inline uint64_t
+browse_align(int64_t ts)
+{
+	if (ts < 0)
+		return 0;
+
+	return ts & ~(((uint64_t)1 << browse_zoom) - 1);
+}
+
+/*
+ * Centers the browsed window on the next level change of the enabled logic
+ * channels (see logic_edge_next()) after its middle pixel column. Returns 0
+ * if there's none.
+ */
+static int
+browse_edge_next(int width)
+{
+	history_snapshot_t snap;
+	uint64_t ts_next = browse_ts_start + ((uint64_t)width << browse_zoom) / 2 + ((uint64_t)1 << browse_zoom);
+	uint64_t index, edge, ts_edge;
+	int chan;
+
+	if (!history_snapshot(&snap) || snap.length == 0)
+		return 0;
+
+	index = history_find(ts_next, 0, snap.length);
+	index = index > 0 ? index - 1 : 0;
+	edge  = snap.length;
+	chan  = 0;
+	while (chan < channelsNum) {
+		if (chanenabled[chan] && logic_channel(chan))
+			edge = MIN(edge, logic_edge_next(chan, index, snap.length));
+		chan++;
+	}
+
+	if (edge >= snap.length)
+		return 0;
+
+	ts_edge = history[edge].timestamp;
+	if (!history_snapshot_valid(&snap))
+		return 0;
+
+	browse_ts_start = browse_align((int64_t)ts_edge - ((int64_t)width << browse_zoom) / 2);
+	return 1;
+}
+
+// Button 1 drags the history (and stops following the trigger), button 2 browses to the next
+// logic edge, button 3 returns to the live view
+static gboolean
+cb_button_press (GtkWidget	*area,
+                 GdkEventButton	*event,
+                 gpointer	 data)
+{
+	switch (event->button) {
+		case 1:
+			if (!browsing) {
+				int width = gdk_window_get_width(gtk_widget_get_window(area));
+				uint64_t units_per_px = (frame_ts_end - frame_ts_start) / (width ? width : 1);
+
+				if (frame_ts_end <= frame_ts_start)
+					return TRUE;
+
+				browse_zoom = 0;
+				while (((uint64_t)1 << browse_zoom) < units_per_px && browse_zoom < 40)
+					browse_zoom++;
+				browse_ts_start = browse_align(frame_ts_start);
+				browsing = 1;
+			}
+			browse_drag_x  = event->x;
+			browse_drag_ts = browse_ts_start;
+			break;
+		case 2:
+			if (browsing)
+				browse_edge_next(gdk_window_get_width(gtk_widget_get_window(area)));
+			break;
+		case 3:
+			if (browsing)
+				tilecache_flush();
+			browsing = 0;
+			break;
+	}
+
+	gtk_widget_queue_draw(area);
+	return TRUE;
+}
+
+static gboolean
+cb_motion_notify (GtkWidget		*area,
+                  GdkEventMotion	*event,
+                  gpointer		 data)
+{
+	if (!browsing || !(event->state & GDK_BUTTON1_MASK))
+		return FALSE;
+
+	browse_ts_start = browse_align((int64_t)browse_drag_ts - (int64_t)((event->x - browse_drag_x) * ((uint64_t)1 << browse_zoom)));
+	gtk_widget_queue_draw(area);
+	return TRUE;
+}
+
+// Zooms by powers of 2, so the tiles of a revisited zoom level are reused
+static gboolean
+cb_scroll (GtkWidget		*area,
+           GdkEventScroll	*event,
+           gpointer		 data)
+{
+	int delta;
+
+	switch (event->direction) {
+		case GDK_SCROLL_UP:
+			delta = -1;
+			break;
+		case GDK_SCROLL_DOWN:
+			delta = 1;
+			break;
+		default:
+			return FALSE;
+	}
+
+	if (!browsing) {
+		x_userdiv = delta > 0 ? MIN(x_userdiv * 2, 1) : x_userdiv / 2;
+	} else if (browse_zoom + delta >= 0 && browse_zoom + delta <= 40) {
+		uint64_t ts_pointer = browse_ts_start + ((uint64_t)event->x << browse_zoom);
+		browse_zoom += delta;
+		browse_ts_start = browse_align((int64_t)ts_pointer - ((int64_t)event->x << browse_zoom));
+	}
+
+	gtk_widget_queue_draw(area);
 	return TRUE;
 }
 
@@ -481,6 +1220,8 @@ update (void *arg)
 	GtkWidget *area = arg;
 
 	while (running) {
+		if (remote_fd != -1)
+			remote_fetch();
 		gtk_widget_queue_draw(area);
 		usleep(AUTOUPDATE_USECS);
 	}
@@ -495,21 +1236,30 @@ main (int    argc,
 	pthread_t thread_fetcher;
 	pthread_t thread_autoupdate;
 	char *dumppath = NULL;
+	char *convertpath = NULL;
+	char *statspath = NULL;
+	char *sharename = NULL;
+	char *attachname = NULL;
+	char *servename = NULL;
+	char *remotename = NULL;
+	char  autoset_startup = 0;
 	char tailonly = 0;
+	uint64_t historysize = HISTORY_SIZE_DEFAULT;
+	int mmapflags = 0;
+	gboolean gui;
 	//sensor_open();
 
-	history = xcalloc(HISTORY_SIZE * 2 + 1, sizeof(history_t));
-
 
 	GtkWidget *main_window,
 	          *button,
 	          *area;
 
-	gtk_init (&argc, &argv);
+	gui = gtk_init_check (&argc, &argv);
+	dumplayout = BINLOG_LAYOUT_LEGACY(1);
 
 	// Parsing arguments
 	char c;
-	while ((c = getopt (argc, argv, "i:tfC:M:")) != -1) {
+	while ((c = getopt (argc, argv, "i:tfC:M:o:S:N:m:PLs:a:T:r:O:F:X:D:W:c:AV:B:")) != -1) {
 		char *arg;
 		arg = optarg;
 
@@ -527,28 +1277,254 @@ main (int    argc,
 			case 'M':
 				mathChannelsNum = atoi(arg);
 				break;
+			case 'o':
+				convertpath = arg;
+				break;
+			case 'S':
+				statspath = arg;
+				break;
+			case 'N':
+				historysize = atoll(arg);
+				break;
+			case 'm':
+				historysize = (atoll(arg) << 20) / (2 * sizeof(history_t));
+				break;
+			case 'P':
+				mmapflags |= MMAPF_HUGETLB;
+				break;
+			case 'L':
+				mmapflags |= MMAPF_LOCK;
+				break;
+			case 's':
+				sharename = arg;
+				break;
+			case 'a':
+				attachname = arg;
+				break;
+			case 'T':
+				if (trigger_parse(arg))
+					return 1;
+				break;
+			case 'r':
+				replay_speed = atof(arg);
+				replaying    = 1;
+				break;
+			case 'O':
+				if (overload_parse(arg))
+					return 1;
+				break;
+			case 'F':
+				if (binlog_layout_parse(arg, &dumplayout))
+					return 1;
+				break;
+			case 'X':
+				if (xy_parse(arg))
+					return 1;
+				break;
+			case 'D':
+				if (logic_parse(arg))
+					return 1;
+				break;
+			case 'W':
+				servename = arg;
+				break;
+			case 'c':
+				remotename = arg;
+				break;
+			case 'A':
+				autoset_startup = 1;
+				break;
+			case 'V':
+				if (acquire_parse(arg))
+					return 1;
+				break;
+			case 'B':
+				if (filter_parse(arg))
+					return 1;
+				break;
 			default:
 				abort ();
 		}
 	}
 
 
+	assert ( channelsNum     > 0 );
 	assert ( channelsNum     < MAX_REAL_CHANNELS );
 	assert ( mathChannelsNum < MAX_MATH_CHANNELS );
+	dumplayout.channels = channelsNum;
 
-	dump_open(dumppath, tailonly);
+	// The filters' outputs are virtual channels after the real ones
+	if (filters_num) {
+		if (remotename != NULL || attachname != NULL) {
+			fprintf(stderr, "Filters are run by the process reading the input\n");
+			return 1;
+		}
+		channelsNum = filter_setup(channelsNum);
+		if (channelsNum < 0)
+			return 1;
+	}
+	autoset_channels_num = channelsNum;
 
-	if (pthread_create(&thread_fetcher, NULL, history_fetcher, NULL)) {
-		fprintf(stderr, "Error creating thread\n");
+	if (xy_enabled && (xy_config.x >= channelsNum || xy_config.y >= channelsNum)) {
+		fprintf(stderr, "XY channels should be less than the number of channels (%i)\n", channelsNum);
+		return 1;
+	}
+
+	if (trigger_config.channel >= channelsNum) {
+		fprintf(stderr, "The trigger channel should be less than the number of channels (%i)\n", channelsNum);
+		return 1;
+	}
+
+	if (logic_channel_last() >= channelsNum) {
+		fprintf(stderr, "Logic channels should be less than the number of channels (%i)\n", channelsNum);
+		return 1;
+	}
+
+	if (historysize < 2 || historysize > HISTORY_SIZE_MAX) {
+		fprintf(stderr, "History size should be in [2; %u] records\n", HISTORY_SIZE_MAX);
+		return 1;
+	}
+
+	if (convertpath != NULL) {
+		if (dumppath == NULL || columnar_convert(dumppath, convertpath, &dumplayout, 0)) {
+			fprintf(stderr, "Cannot convert \"%s\" to \"%s\"\n", dumppath, convertpath);
+			return 4;
+		}
+		return 0;
+	}
+
+	sigset_t sigset_exit;
+	sigemptyset(&sigset_exit);
+	sigaddset(&sigset_exit, SIGINT);
+	sigaddset(&sigset_exit, SIGTERM);
+
+	if (!gui) {
+		if ((sharename == NULL && servename == NULL) || attachname != NULL || remotename != NULL) {
+			fprintf(stderr, "Cannot initialize GTK\n");
+			return 3;
+		}
+
+		// A headless producer: the threads below inherit the mask, so only sigwait() gets the signals
+		pthread_sigmask(SIG_BLOCK, &sigset_exit, NULL);
+	}
+
+	error_init_ipc(IPCT_PRIVATE);
+	error_init_async();
+
+	if (stats_init(statspath)) {
+		fprintf(stderr, "Cannot initialize statistics\n");
 		return 1;
 	}
 
+	if (remotename != NULL) {
+		server_frame_t    frame;
+		server_column_t   column[MAX_REAL_CHANNELS];
+
+		// A thin client: the history is on the server, only the channel count is needed
+		remote_address = remotename;
+		remote_fd      = server_connect(remotename);
+		if (remote_fd == -1 || server_request_frame(remote_fd, SERVER_FRAME_LIVE, 1, 1, 0, &frame, column))
+			return 4;
+		channelsNum  = frame.channels;
+		history_size = historysize;
+	} else if (attachname != NULL) {
+		// A viewer of another process' history: nothing to fetch
+		if (history_attach(attachname, &channelsNum))
+			return 4;
+	} else {
+		if (sharename != NULL) {
+			if (history_alloc_shared(sharename, historysize, channelsNum, mmapflags))
+				return 4;
+		} else {
+			history_alloc(historysize, mmapflags);
+		}
+
+		if (dumppath != NULL && columnar_probe(dumppath)) {
+			if (replaying) {
+				fprintf(stderr, "Only a binlog may be replayed\n");
+				return 1;
+			}
+			if (filters_num) {
+				fprintf(stderr, "Only a binlog may be filtered\n");
+				return 1;
+			}
+
+			ssize_t loaded = columnar_load_tail(dumppath, history, history_size * 2 - 1, &channelsNum);
+			if (loaded < 0)
+				return 4;
+			history_set_channels(channelsNum);
+			history_length = loaded;
+			history_commit();
+		} else {
+			dump_open(dumppath, tailonly && !replaying);
+
+			off_t    pos    = ftello(dump);
+			uint64_t offset = pos > 0 ? pos : 0;
+
+			// Decode the part of the file fitting into the history on all the cores, then follow it.
+			// To draw the first frame right away, only the last screenful is decoded here and
+			// the rest is backfilled on its own thread (narrow timestamps are unwrapped only in order).
+			if (!tailonly && !replaying) {
+				uint64_t max_records = history_size * 2 - 1;
+				uint64_t records     = max_records;
+				uint64_t first;
+
+				if (dumplayout.ts_device_size == sizeof(uint64_t))
+					records = MIN((uint64_t)(history_size * x_userdiv) + 2, history_size);
+
+				ssize_t loaded = ingest_load_tail(fileno(dump), &dumplayout, history, records, max_records, &offset, &first);
+				if (loaded < 0)
+					return 4;
+
+				if (records < max_records && first > (pos > 0 ? (uint64_t)pos : 0)) {
+					backfill_from = pos > 0 ? pos : 0;
+					backfill_to   = first;
+					backfilling   = 1;
+				}
+
+				history_length = loaded;
+				uint64_t i = 0;
+				while (i < history_length)
+					record_feed(&history[i++]);
+				history_commit();
+			}
+
+			if (ingest_start(fileno(dump), offset, &dumplayout, replaying))
+				return 1;
+
+			if (pthread_create(&thread_fetcher, NULL, history_fetcher, NULL)) {
+				fprintf(stderr, "Error creating thread\n");
+				return 1;
+			}
+			fetching = 1;
+		}
+	}
+	draw_kernel_select(channelsNum);
+	autoset_channels_num = channelsNum;
+
+	if (servename != NULL && remote_fd == -1 && server_start(servename, channelsNum))
+		return 4;
+
+	if (!gui) {
+		int signum;
+		sigwait(&sigset_exit, &signum);
+
+		// The fetcher may be blocked on input, so it's not joined
+		running = 0;
+		server_stop();
+		ingest_stop();
+		history_unlink();
+		stats_deinit();
+		error_deinit();
+		return 0;
+	}
+
 	builder = gtk_builder_new();
 
 	GError *gerr = NULL;
 
-	if ( gtk_builder_add_from_file (builder, GLADE_PATH, &gerr) <= 0 ) {
-		fprintf(stderr, "Cannot parse file \""GLADE_PATH"\": %s\n", gerr->message);
+	if ( gtk_builder_add_from_resource (builder, GLADE_RESOURCE, &gerr) <= 0 ) {
+		fprintf(stderr, "Cannot load resource \""GLADE_RESOURCE"\": %s\n", gerr->message);
 		return 3;
 	}
 	main_window = GTK_WIDGET ( gtk_builder_get_object (builder, "mainwindow") );
@@ -568,11 +1544,19 @@ main (int    argc,
 	assert (area != NULL);
 
 	g_signal_connect (area, "draw",   G_CALLBACK (cb_draw), NULL);
+	gtk_widget_add_events (area, GDK_BUTTON_PRESS_MASK | GDK_BUTTON1_MOTION_MASK | GDK_SCROLL_MASK);
+	g_signal_connect (area, "button-press-event",  G_CALLBACK (cb_button_press),  NULL);
+	g_signal_connect (area, "motion-notify-event", G_CALLBACK (cb_motion_notify), NULL);
+	g_signal_connect (area, "scroll-event",        G_CALLBACK (cb_scroll),        NULL);
 	//g_signal_connect (area, "resize", G_CALLBACK (cb_resize), main_window);
 	g_signal_connect (area, "configure-event", G_CALLBACK(cb_resize), NULL);
 
 	g_signal_connect_swapped (button, "clicked",
 	                          G_CALLBACK (gtk_widget_queue_draw), area);
+
+	GtkWidget *autoset_button = GTK_WIDGET ( gtk_builder_get_object(builder, "autoset") );
+	if (autoset_button != NULL)
+		g_signal_connect (autoset_button, "clicked", G_CALLBACK (cb_autoset), area);
 	gtk_widget_show_all (main_window);
 
 	if (pthread_create(&thread_autoupdate, NULL, update, area)) {
@@ -665,22 +1649,32 @@ main (int    argc,
 
 	arrange_widgets();
 
+	if (autoset_startup)
+		g_timeout_add(AUTOSET_STARTUP_POLL_MSECS, cb_autoset_pending, area);
+
 	gtk_main ();
 
 	running = 0;
+	server_stop();
+	ingest_stop();
 
 	if (pthread_join(thread_autoupdate, NULL)) {
 		fprintf(stderr, "Error joining thread\n");
 		return 2;
 	}
-	if (pthread_join(thread_fetcher, NULL)) {
+	if (fetching && pthread_join(thread_fetcher, NULL)) {
 		fprintf(stderr, "Error joining thread\n");
 		return 2;
 	}
 
 //	sensor_close();
 	dump_close();
-	free(history);
+	stats_deinit();
+	if (remote_fd != -1)
+		close(remote_fd);
+	else
+		history_free();
+	error_deinit();
 	return 0;
 }
 
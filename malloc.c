@@ -33,6 +33,10 @@
 
 #include <sys/ipc.h>			// shmget()
 #include <sys/shm.h>			// shmget()
+#include <sys/mman.h>			// mmap()
+#include <sys/stat.h>			// fstat()
+#include <fcntl.h>			// O_CREAT
+#include <unistd.h>			// ftruncate()
 
 #include "malloc.h"
 #include "error.h"
@@ -241,3 +245,117 @@ void shm_free(void *ptr) {
 	shmdt(ptr);
 }
 
+#define MMAP_HUGEPAGE_SIZE (2 << 20)
+
+/*
+ * Anonymous mapping for big buffers: pages are committed (and zeroed by the
+ * kernel) on the first touch only. Without MMAPF_HUGETLB (or if there're
+ * no reserved huge pages) transparent huge pages are requested.
+ */
+void *mmap_malloc(size_t size, int flags) {
+	void *ret = MAP_FAILED;
+	debug(20, "(%li, 0x%x)", size, flags);
+
+	size = (size + MMAP_HUGEPAGE_SIZE - 1) & ~((size_t)MMAP_HUGEPAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+	if (flags & MMAPF_HUGETLB) {
+		ret = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_HUGETLB, -1, 0);
+		if (ret == MAP_FAILED)
+			warning("(%li): Cannot allocate huge pages, falling back to transparent ones.", size);
+	}
+#endif
+
+	if (ret == MAP_FAILED) {
+		ret = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+		if (ret == MAP_FAILED)
+			critical("(%li): Cannot allocate memory.", size);
+#ifdef MADV_HUGEPAGE
+		madvise(ret, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	if (flags & MMAPF_LOCK) {
+		if (mlock(ret, size))
+			warning("(%li): Cannot lock memory.", size);
+	}
+
+	return ret;
+}
+
+void mmap_free(void *ptr, size_t size) {
+	debug(25, "(%p, %li)", ptr, size);
+	size = (size + MMAP_HUGEPAGE_SIZE - 1) & ~((size_t)MMAP_HUGEPAGE_SIZE - 1);
+	munmap(ptr, size);
+}
+
+/*
+ * Named (POSIX) shared memory for other processes to attach to. The creator
+ * maps it read-write (with the mmap_malloc() "flags"; a tmpfs object can't
+ * have explicit huge pages, so MMAPF_HUGETLB falls back to transparent
+ * ones), shm_attach_named() maps it read-only. Both return NULL on failure.
+ */
+void *shm_malloc_named(const char *name, size_t size, int flags) {
+	void *ret;
+	int fd;
+	debug(20, "(\"%s\", %li, 0x%x)", name, size, flags);
+
+	fd = shm_open(name, O_RDWR|O_CREAT|O_TRUNC, 0600);
+	if (fd == -1)
+		return NULL;
+
+	if (ftruncate(fd, size)) {
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	ret = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ret == MAP_FAILED) {
+		shm_unlink(name);
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(ret, size, MADV_HUGEPAGE);
+#endif
+
+	if (flags & MMAPF_HUGETLB)
+		warning("(\"%s\", %li): Cannot allocate huge pages for shared memory, falling back to transparent ones.", name, size);
+
+	if (flags & MMAPF_LOCK) {
+		if (mlock(ret, size))
+			warning("(\"%s\", %li): Cannot lock memory.", name, size);
+	}
+
+	return ret;
+}
+
+void *shm_attach_named(const char *name, size_t *size_p) {
+	struct stat st;
+	void *ret;
+	int fd;
+	debug(20, "(\"%s\")", name);
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	ret = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ret == MAP_FAILED)
+		return NULL;
+
+	*size_p = st.st_size;
+	return ret;
+}
+
+void shm_free_named(void *ptr, size_t size) {
+	debug(25, "(%p, %li)", ptr, size);
+	munmap(ptr, size);
+}
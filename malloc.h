@@ -34,6 +34,16 @@ extern void *shm_malloc(size_t size);
 extern void *shm_malloc_try(size_t size);
 extern void *shm_calloc(size_t nmemb, size_t size);
 extern void shm_free(void *ptr);
+extern void *shm_malloc_named(const char *name, size_t size, int flags);
+extern void *shm_attach_named(const char *name, size_t *size_p);
+extern void shm_free_named(void *ptr, size_t size);
+
+enum mmap_flags {
+	MMAPF_HUGETLB	= 0x01,		/* explicit huge pages (falls back to THP) */
+	MMAPF_LOCK	= 0x02,		/* mlock() the region */
+};
+extern void *mmap_malloc(size_t size, int flags);
+extern void mmap_free(void *ptr, size_t size);
 
 extern int memory_init();
 
@@ -17,7 +17,10 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "macros.h"
+
 #include <string.h>
+#include <errno.h>
 #include <pthread.h>
 #include "pthreadex.h"
 #include "malloc.h"
@@ -67,7 +70,7 @@ int pthread_mutex_reltimedlock(pthread_mutex_t *mutex_p, long tv_sec, long tv_ns
 	abs_time.tv_sec  += tv_sec;
 	abs_time.tv_nsec += tv_nsec;
 
-	if (abs_time.tv_nsec > 1000*1000*1000) {
+	if (abs_time.tv_nsec >= 1000*1000*1000) {
 		abs_time.tv_sec++;
 		abs_time.tv_nsec -= 1000*1000*1000;
 	}
@@ -75,3 +78,93 @@ int pthread_mutex_reltimedlock(pthread_mutex_t *mutex_p, long tv_sec, long tv_ns
 	return pthread_mutex_timedlock(mutex_p, &abs_time);
 }
 
+pthread_lockstat_t *pthread_lockstat_list = NULL;
+
+static void pthread_lockstat_register(pthread_lockstat_t *site) {
+	if (__atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	site->next = __atomic_load_n(&pthread_lockstat_list, __ATOMIC_ACQUIRE);
+	while (!__atomic_compare_exchange_n(&pthread_lockstat_list, &site->next, site, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+static inline void pthread_lockstat_acquired(pthread_lockstat_t *site, uint64_t ts_start, int contended) {
+	uint64_t now = stats_now();
+
+	if (unlikely(!site->registered))
+		pthread_lockstat_register(site);
+
+	__atomic_fetch_add(&site->acquired, 1, __ATOMIC_RELAXED);
+	if (contended)
+		__atomic_fetch_add(&site->contended, 1, __ATOMIC_RELAXED);
+	stats_record(&site->wait, now - ts_start);
+	site->ts_locked = now;
+}
+
+int pthread_mutex_lock_stat(pthread_mutex_t *mutex_p, pthread_lockstat_t *site) {
+	uint64_t ts_start = stats_now();
+	int rc;
+
+	rc = pthread_mutex_trylock(mutex_p);
+	if (rc == EBUSY) {
+		rc = pthread_mutex_lock(mutex_p);
+		if (!rc)
+			pthread_lockstat_acquired(site, ts_start, 1);
+		return rc;
+	}
+
+	if (!rc)
+		pthread_lockstat_acquired(site, ts_start, 0);
+	return rc;
+}
+
+int pthread_mutex_trylock_stat(pthread_mutex_t *mutex_p, pthread_lockstat_t *site) {
+	uint64_t ts_start = stats_now();
+	int rc;
+
+	rc = pthread_mutex_trylock(mutex_p);
+	if (!rc) {
+		pthread_lockstat_acquired(site, ts_start, 0);
+	} else if (rc == EBUSY) {
+		if (unlikely(!site->registered))
+			pthread_lockstat_register(site);
+		__atomic_fetch_add(&site->contended, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&site->timedout,  1, __ATOMIC_RELAXED);
+	}
+
+	return rc;
+}
+
+int pthread_mutex_reltimedlock_stat(pthread_mutex_t *mutex_p, pthread_lockstat_t *site, long tv_sec, long tv_nsec) {
+	uint64_t ts_start = stats_now();
+	int rc;
+
+	rc = pthread_mutex_trylock(mutex_p);
+	if (rc != EBUSY) {
+		if (!rc)
+			pthread_lockstat_acquired(site, ts_start, 0);
+		return rc;
+	}
+
+	rc = pthread_mutex_reltimedlock(mutex_p, tv_sec, tv_nsec);
+	if (!rc) {
+		pthread_lockstat_acquired(site, ts_start, 1);
+	} else if (rc == ETIMEDOUT) {
+		if (unlikely(!site->registered))
+			pthread_lockstat_register(site);
+		__atomic_fetch_add(&site->contended, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&site->timedout,  1, __ATOMIC_RELAXED);
+		stats_record(&site->wait, stats_now() - ts_start);
+	}
+
+	return rc;
+}
+
+int pthread_mutex_unlock_stat(pthread_mutex_t *mutex_p, pthread_lockstat_t *site) {
+	uint64_t ts_locked = site->ts_locked;
+	int rc;
+
+	rc = pthread_mutex_unlock(mutex_p);
+	stats_record(&site->hold, stats_now() - ts_locked);
+	return rc;
+}
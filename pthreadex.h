@@ -17,11 +17,44 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef __VOLTLOGGER_PTHREADEX_H
+#define __VOLTLOGGER_PTHREADEX_H
+
 #include <pthread.h>
 
+#include "stats.h"
+
+/*
+ * Per lock site statistics. A site is a place in the code where a mutex is
+ * taken; the same mutex may be taken at several sites. Sites register
+ * themselves on the first use and are dumped by stats_dump().
+ */
+typedef struct pthread_lockstat {
+	const char		*name;
+	struct pthread_lockstat	*next;
+	char			 registered;
+
+	uint64_t		 acquired;
+	uint64_t		 contended;
+	uint64_t		 timedout;
+	uint64_t		 ts_locked;	/* written only by the holder */
+
+	stats_histogram_t	 wait;
+	stats_histogram_t	 hold;
+} pthread_lockstat_t;
+
+#define PTHREAD_LOCKSTAT_INITIALIZER(site_name) { .name = site_name }
+
+extern pthread_lockstat_t *pthread_lockstat_list;
+
 extern int pthread_mutex_init_shared(pthread_mutex_t **mutex_p);
 extern int pthread_mutex_destroy_shared(pthread_mutex_t *mutex_p);
 extern int pthread_cond_init_shared(pthread_cond_t **cond_p);
 extern int pthread_cond_destroy_shared(pthread_cond_t *cond_p);
 extern int pthread_mutex_reltimedlock(pthread_mutex_t *mutex_p, long tv_sec, long tv_nsec);
+extern int pthread_mutex_lock_stat(pthread_mutex_t *mutex_p, pthread_lockstat_t *site);
+extern int pthread_mutex_trylock_stat(pthread_mutex_t *mutex_p, pthread_lockstat_t *site);
+extern int pthread_mutex_reltimedlock_stat(pthread_mutex_t *mutex_p, pthread_lockstat_t *site, long tv_sec, long tv_nsec);
+extern int pthread_mutex_unlock_stat(pthread_mutex_t *mutex_p, pthread_lockstat_t *site);
 
+#endif
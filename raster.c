@@ -0,0 +1,156 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <cairo.h>
+
+#include "raster.h"
+#include "malloc.h"
+
+/* Samples are transformed by blocks to keep the kernel loops vectorizable */
+#define RASTER_BLOCK	256
+
+static raster_t raster = {0};
+
+/* Returns a cleared (transparent) raster of the given size */
+raster_t *raster_get(int width, int height) {
+	if (raster.width != width || raster.height != height) {
+		if (raster.surface != NULL)
+			cairo_surface_destroy(raster.surface);
+		free(raster.pixels);
+
+		raster.width   = width;
+		raster.height  = height;
+		raster.stride  = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width) / sizeof(uint32_t);
+		raster.pixels  = xmalloc((size_t)raster.stride * height * sizeof(uint32_t));
+		raster.surface = cairo_image_surface_create_for_data((unsigned char *)raster.pixels, CAIRO_FORMAT_ARGB32, width, height, raster.stride * sizeof(uint32_t));
+	}
+
+	cairo_surface_flush(raster.surface);
+	memset(raster.pixels, 0, (size_t)raster.stride * height * sizeof(uint32_t));
+	return &raster;
+}
+
+cairo_surface_t *raster_surface(raster_t *r) {
+	cairo_surface_mark_dirty(r->surface);
+	return r->surface;
+}
+
+/*
+ * x = x_offset + ((ts - ts_start) * x_mul) >> 32
+ * y = (y_off - value * y_mul) >> 16
+ */
+static void raster_transform(const uint64_t *ts, const uint32_t *value, size_t n, uint64_t ts_start, uint64_t ts_span, uint64_t x_mul, int32_t x_offset, int64_t y_off, int64_t y_mul, int32_t *x, int32_t *y) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		uint64_t diff = ts[i] - ts_start;
+		diff = diff > ts_span ? ts_span : diff;
+		x[i] = x_offset + (int32_t)((diff * x_mul) >> 32);
+		y[i] = (int32_t)((y_off - (int64_t)value[i] * y_mul) >> 16);
+	}
+}
+
+static inline void raster_span(raster_t *r, int x, int lo, int hi, uint32_t src, uint32_t inv_alpha) {
+	if (x < 0 || x >= r->width)
+		return;
+
+	if (lo > hi) {
+		int t = lo;
+		lo = hi;
+		hi = t;
+	}
+	lo = MAX(lo, 0);
+	hi = MIN(hi, r->height - 1);
+
+	uint32_t *p = &r->pixels[(size_t)lo * r->stride + x];
+	while (lo <= hi) {
+		uint32_t dst = *p;
+		uint32_t rb  = ((dst & 0x00ff00ff) * inv_alpha >> 8) & 0x00ff00ff;
+		uint32_t ag  = ((dst >> 8) & 0x00ff00ff) * inv_alpha & 0xff00ff00;
+		*p = src + rb + ag;
+		p += r->stride;
+		lo++;
+	}
+}
+
+void raster_trace(raster_t *r, const history_t *h, size_t count, int chan, const raster_trace_t *t) {
+	uint64_t ts   [RASTER_BLOCK];
+	uint32_t value[RASTER_BLOCK];
+	int32_t  x    [RASTER_BLOCK];
+	int32_t  y    [RASTER_BLOCK];
+	uint64_t x_mul = ((uint64_t)r->width << 32) / t->ts_span;
+	int64_t  y_off = t->y_offset * 65536;
+	int64_t  y_mul = t->y_scale  * 65536;
+	uint32_t a     = t->alpha * 255;
+	uint32_t src   = a << 24 | (uint32_t)(t->color[0] * a) << 16 | (uint32_t)(t->color[1] * a) << 8 | (uint32_t)(t->color[2] * a);
+	uint32_t inv_alpha = 256 - a;
+	int col = 0, lo = 0, hi = 0, prev_y = 0;
+	char started = 0;
+	size_t done = 0;
+
+	while (done < count) {
+		size_t n = MIN(count - done, RASTER_BLOCK);
+		size_t i;
+
+		for (i = 0; i < n; i++) {
+			ts[i]    = h[done + i].timestamp;
+			value[i] = h[done + i].value[chan];
+		}
+		raster_transform(ts, value, n, t->ts_start, t->ts_span, x_mul, t->x_offset, y_off, y_mul, x, y);
+
+		for (i = 0; i < n; i++) {
+			if (unlikely(!started)) {
+				col = x[i];
+				lo  = hi = prev_y = y[i];
+				started = 1;
+				continue;
+			}
+
+			if (x[i] != col) {
+				raster_span(r, col, lo, hi, src, inv_alpha);
+
+				// Interpolate over the columns without samples
+				int c = col + 1;
+				int y_from = prev_y;
+				while (c < x[i]) {
+					int y_to = prev_y + (int64_t)(y[i] - prev_y) * (c - col) / (x[i] - col);
+					raster_span(r, c, y_from, y_to, src, inv_alpha);
+					y_from = y_to;
+					c++;
+				}
+
+				col = x[i];
+				lo  = hi = y_from;
+			}
+
+			lo = MIN(lo, y[i]);
+			hi = MAX(hi, y[i]);
+			prev_y = y[i];
+		}
+
+		done += n;
+	}
+
+	if (started)
+		raster_span(r, col, lo, hi, src, inv_alpha);
+}
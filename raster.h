@@ -0,0 +1,57 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_RASTER_H
+#define __VOLTLOGGER_RASTER_H
+
+#include <cairo.h>
+
+#include "history.h"
+
+/*
+ * CPU rasterizer for dense traces: samples are transformed to pixels with
+ * a fixed-point affine kernel and every pixel column gets one vertical span
+ * covering all the samples falling into it (and the connection to the
+ * previous column). It's much cheaper than stroking a cairo path of the
+ * same points and looks the same when there're several samples per pixel.
+ */
+
+typedef struct {
+	int		 width;
+	int		 height;
+	int		 stride;		/* in pixels */
+	uint32_t	*pixels;		/* CAIRO_FORMAT_ARGB32 */
+	cairo_surface_t	*surface;
+} raster_t;
+
+typedef struct {
+	uint64_t ts_start;
+	uint64_t ts_span;			/* > 0 */
+	int      x_offset;
+	double   y_offset;
+	double   y_scale;
+	double   color[3];
+	double   alpha;
+} raster_trace_t;
+
+extern raster_t        *raster_get(int width, int height);
+extern void             raster_trace(raster_t *r, const history_t *h, size_t count, int chan, const raster_trace_t *t);
+extern cairo_surface_t *raster_surface(raster_t *r);
+
+#endif
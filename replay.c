@@ -0,0 +1,102 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "macros.h"
+
+#include <time.h>
+
+#include "configuration.h"
+#include "replay.h"
+#include "error.h"
+#include "stats.h"
+
+double replay_speed = 1;
+
+static char     replay_started = 0;
+static uint64_t replay_records = 0;
+static uint64_t replay_ts_first;
+static uint64_t replay_ts_last;
+static uint64_t replay_wall_first;
+
+void replay_pace(uint64_t ts_parse) {
+	uint64_t now = stats_now();
+	uint64_t due;
+	int64_t  offset;
+
+	replay_records++;
+	if (unlikely(!replay_started)) {
+		replay_ts_first   = ts_parse;
+		replay_wall_first = now;
+		replay_started    = 1;
+	}
+	replay_ts_last = ts_parse;
+
+	if (replay_speed <= 0)
+		return;
+
+	offset = ts_parse - replay_ts_first;
+	due    = replay_wall_first + (offset > 0 ? offset / replay_speed : 0);
+
+	// Records closer than REPLAY_SLEEP_NSECS to their time are let through in a burst
+	if (now + REPLAY_SLEEP_NSECS < due) {
+		struct timespec ts;
+
+		ts.tv_sec  = due / (1000*1000*1000);
+		ts.tv_nsec = due % (1000*1000*1000);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		return;
+	}
+
+	if (now > due)
+		stats_record(&stats_histograms[STATS_H_REPLAY_LAG], now - due);
+
+	return;
+}
+
+void replay_report() {
+	stats_histogram_t *lag  = &stats_histograms[STATS_H_REPLAY_LAG];
+	stats_histogram_t *draw = &stats_histograms[STATS_H_DRAW];
+	uint64_t wall   = stats_now() - replay_wall_first;
+	uint64_t span   = replay_ts_last - replay_ts_first;
+	uint64_t frames = __atomic_load_n(&stats_counters[STATS_FRAMES], __ATOMIC_RELAXED);
+	uint64_t lag_max   = __atomic_load_n(&lag->max, __ATOMIC_RELAXED);
+	uint64_t draw_p99  = stats_quantile(draw, __atomic_load_n(&draw->count, __ATOMIC_RELAXED), 0.99);
+
+	if (!replay_started || !wall) {
+		info("replay: no records");
+		return;
+	}
+
+	info("replay: %lu records (%.3fs recorded) in %.3fs: x%.2f, %.0f records/s",
+		replay_records, (double)span / 1E9, (double)wall / 1E9,
+		(double)span / wall, (double)replay_records * 1E9 / wall);
+
+	info("replay: ingest %s (max lag %.3fs)",
+		lag_max <= REPLAY_LAG_TOLERANCE_NSECS ? "kept up" : "fell behind",
+		(double)lag_max / 1E9);
+
+	if (frames)
+		info("replay: rendering %s (%lu frames, %.1f fps, p99 draw < %.3fs)",
+			draw_p99 <= AUTOUPDATE_USECS * 1000 ? "kept up" : "fell behind",
+			frames, (double)frames * 1E9 / wall, (double)draw_p99 / 1E9);
+	else
+		info("replay: nothing rendered");
+
+	return;
+}
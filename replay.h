@@ -0,0 +1,38 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_REPLAY_H
+#define __VOLTLOGGER_REPLAY_H
+
+#include <stdint.h>
+
+/*
+ * Replay of a recorded binlog (see "-r"): the fetcher calls replay_pace()
+ * after every record and it sleeps until the record's ts_parse (relative
+ * to the first record) divided by "replay_speed" passes. Falling behind
+ * is measured as the lag histogram, replay_report() tells whether ingest
+ * and rendering kept up.
+ */
+
+extern double replay_speed;		/* 0 -- unthrottled */
+
+extern void replay_pace(uint64_t ts_parse);
+extern void replay_report();
+
+#endif
@@ -0,0 +1,394 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "macros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "server.h"
+#include "error.h"
+#include "stats.h"
+#include "trigger.h"
+
+/* Attempts to get a frame not disturbed by history_flush() */
+#define SERVER_FRAME_RETRIES	3
+
+static int       server_socket   = -1;
+static int       server_channels;
+static char      server_unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_t server_thread;
+
+static server_column_t server_columns[SERVER_COLUMNS_MAX * MAX_REAL_CHANNELS];
+
+/*
+ * Resolves "unix:<path>" or "tcp:[<host>:]<port>" and returns a socket
+ * bound to it (with "listening") or connected to it, or -1.
+ */
+static int server_socket_open(const char *address, char listening) {
+	int fd;
+
+	if (!strncmp(address, "unix:", 5)) {
+		struct sockaddr_un addr;
+		const char *path = &address[5];
+
+		if (strlen(path) >= sizeof(addr.sun_path)) {
+			error("Too long socket path: \"%s\"", path);
+			return -1;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, path);
+
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd == -1)
+			return -1;
+
+		if (listening) {
+			unlink(path);
+			if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, SERVER_CLIENTS_MAX)) {
+				close(fd);
+				return -1;
+			}
+			strcpy(server_unix_path, path);
+		} else if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+			close(fd);
+			return -1;
+		}
+
+		return fd;
+	}
+
+	if (!strncmp(address, "tcp:", 4)) {
+		struct addrinfo hints, *res, *ai;
+		char host[BUFSIZ], *port;
+		int one = 1;
+
+		strncpy(host, &address[4], sizeof(host) - 1);
+		host[sizeof(host) - 1] = 0;
+		port = strrchr(host, ':');
+		if (port != NULL)
+			*port++ = 0;
+		else
+			port = host;
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags    = listening ? AI_PASSIVE : 0;
+		if (getaddrinfo(port == host ? NULL : host, port, &hints, &res)) {
+			error("Cannot resolve \"%s\"", address);
+			return -1;
+		}
+
+		fd = -1;
+		ai = res;
+		while (ai != NULL && fd == -1) {
+			fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+			if (fd != -1) {
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				if (listening)
+					setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+				if (listening ? bind(fd, ai->ai_addr, ai->ai_addrlen) || listen(fd, SERVER_CLIENTS_MAX) :
+						connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+					close(fd);
+					fd = -1;
+				}
+			}
+			ai = ai->ai_next;
+		}
+		freeaddrinfo(res);
+		return fd;
+	}
+
+	error("Unknown address \"%s\", should be \"unix:<path>\" or \"tcp:[<host>:]<port>\"", address);
+	return -1;
+}
+
+/* A stalled peer fails the transfer instead of blocking the others (or the UI) */
+static void server_set_timeout(int fd) {
+	struct timeval tv;
+
+	tv.tv_sec  = SERVER_TIMEOUT_MSECS / 1000;
+	tv.tv_usec = SERVER_TIMEOUT_MSECS % 1000 * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* Reads or writes exactly "len" bytes, returns 0 on success */
+static int server_io(int fd, void *buf, size_t len, char writing) {
+	char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = writing ? send(fd, p, len, MSG_NOSIGNAL) : recv(fd, p, len, 0);
+
+		if (n <= 0) {
+			if (n == -1 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		p   += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Min/max of the records [start; end] per column of [ts_start; ts_end]
+ * (see the protocol description in server.h).
+ */
+static void server_frame_reduce(uint64_t start, uint64_t end, uint64_t ts_start, uint64_t ts_end, server_frame_t *frame, server_column_t *out) {
+	const int channels = server_channels;
+	uint64_t ts_span = MAX(ts_end - ts_start + 1, ts_end - ts_start);	/* no wrap on the full range */
+	uint64_t i = start;
+	int n = frame->columns * channels;
+
+	while (n--) {
+		out[n].min = UINT16_MAX;
+		out[n].max = 0;
+	}
+
+	while (i <= end) {
+		const history_t *p = &history[i++];
+		server_column_t *col;
+		uint64_t column;
+		int chan = 0;
+
+		// The timestamps may go backwards (a reset counter, a resync)
+		if (p->timestamp < ts_start || p->timestamp > ts_end)
+			continue;
+
+		column = (unsigned __int128)(p->timestamp - ts_start) * frame->columns / ts_span;
+		col    = &out[MIN(column, frame->columns - 1) * channels];
+		while (chan < channels) {
+			uint16_t value = MIN(p->value[chan], UINT16_MAX);
+
+			col[chan].min = MIN(col[chan].min, value);
+			col[chan].max = MAX(col[chan].max, value);
+			chan++;
+		}
+	}
+
+	frame->ts_start = ts_start;
+	frame->ts_end   = ts_end;
+	frame->records  = end - start + 1;
+}
+
+static void server_frame(const server_request_t *req, server_frame_t *frame, server_column_t *out) {
+	int attempt = 0;
+
+	frame->magic    = SERVER_MAGIC;
+	frame->channels = server_channels;
+	frame->columns  = MIN(req->columns, SERVER_COLUMNS_MAX);
+
+	while (attempt++ < SERVER_FRAME_RETRIES) {
+		history_snapshot_t view;
+		uint64_t start, end, ts_start, ts_end;
+
+		if (frame->columns == 0)
+			break;
+
+		if (!history_snapshot(&view) || view.length < 2)
+			continue;
+
+		if (req->type == SERVER_FRAME_LIVE) {
+			uint64_t ts_first, ts_last;
+
+			// The same window as the local live view (see cb_draw())
+			end   = view.length - 2;
+			start = end > req->from ? end - req->from : 0;
+			if (trigger_find(history[start].timestamp, history[end].timestamp, &ts_first, &ts_last)) {
+				start = history_find(ts_first, start, end);
+				if (ts_last > ts_first)
+					end = history_find(ts_last, start, end);
+			}
+			ts_start = history[start].timestamp;
+			ts_end   = history[end].timestamp;
+		} else {
+			if (req->to <= req->from)
+				break;
+
+			start    = history_find(req->from, 0, view.length);
+			end      = history_find(req->to, start, view.length);
+			ts_start = req->from;
+			ts_end   = req->to - 1;
+			if (end-- == start)
+				break;
+		}
+
+		if (start > end)
+			break;
+
+		server_frame_reduce(start, end, ts_start, ts_end, frame, out);
+		if (history_snapshot_valid(&view))
+			return;
+	}
+
+	frame->columns = 0;
+	frame->ts_start = frame->ts_end = frame->records = 0;
+}
+
+static void *server_handler(void *arg) {
+	struct pollfd fds[SERVER_CLIENTS_MAX + 1];
+	int clients = 0;
+
+	fds[0].fd     = server_socket;
+	fds[0].events = POLLIN;
+
+	while (1) {
+		int i;
+
+		if (poll(fds, clients + 1, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			error("Got error from poll()");
+			break;
+		}
+
+		i = 1;
+		while (i <= clients) {
+			server_request_t req;
+			server_frame_t   frame;
+
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+				i++;
+				continue;
+			}
+
+			if (!server_io(fds[i].fd, &req, sizeof(req), 0) && req.magic == SERVER_MAGIC) {
+				size_t bytes;
+
+				server_frame(&req, &frame, server_columns);
+				bytes = (size_t)frame.columns * frame.channels * sizeof(*server_columns);
+				if (!server_io(fds[i].fd, &frame, sizeof(frame), 1) && !server_io(fds[i].fd, server_columns, bytes, 1)) {
+					stats_inc(STATS_FRAMES_SERVED, 1);
+					stats_inc(STATS_SERVED_BYTES, sizeof(frame) + bytes);
+					i++;
+					continue;
+				}
+			}
+
+			// Disconnected, stalled (see server_set_timeout()) or not speaking the protocol
+			close(fds[i].fd);
+			fds[i] = fds[clients--];
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int client = accept4(server_socket, NULL, NULL, SOCK_CLOEXEC);
+
+			if (client != -1 && clients < SERVER_CLIENTS_MAX) {
+				int one = 1;
+
+				setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				server_set_timeout(client);
+				clients++;
+				fds[clients].fd     = client;
+				fds[clients].events = POLLIN;
+			} else if (client != -1) {
+				warning("Too many clients, dropping a new one");
+				close(client);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Serves frames of the history (of "channels" channels) on "address" */
+int server_start(const char *address, int channels) {
+	server_channels = channels;
+	server_socket   = server_socket_open(address, 1);
+	if (server_socket == -1) {
+		error("Cannot listen on \"%s\"", address);
+		return -1;
+	}
+
+	if (pthread_create(&server_thread, NULL, server_handler, NULL)) {
+		error("Cannot create a thread");
+		return -1;
+	}
+
+	info("Serving frames on \"%s\"", address);
+	return 0;
+}
+
+void server_stop() {
+	if (server_socket == -1)
+		return;
+
+	pthread_cancel(server_thread);
+	pthread_join(server_thread, NULL);
+	close(server_socket);
+	if (*server_unix_path)
+		unlink(server_unix_path);
+	*server_unix_path = 0;
+	server_socket = -1;
+}
+
+/* Client side: returns a connected socket or -1 */
+int server_connect(const char *address) {
+	int fd = server_socket_open(address, 0);
+
+	if (fd == -1)
+		error("Cannot connect to \"%s\"", address);
+	else
+		server_set_timeout(fd);
+
+	return fd;
+}
+
+/*
+ * Requests a frame of "columns" columns (see server.h for "from" and "to").
+ * "out" should have room for columns*MAX_REAL_CHANNELS columns. Returns 0
+ * on success.
+ */
+int server_request_frame(int fd, enum server_frame_type type, int columns, uint64_t from, uint64_t to, server_frame_t *frame, server_column_t *out) {
+	server_request_t req;
+
+	req.magic   = SERVER_MAGIC;
+	req.type    = type;
+	req.columns = MIN(columns, SERVER_COLUMNS_MAX);
+	req.from    = from;
+	req.to      = to;
+
+	if (server_io(fd, &req, sizeof(req), 1) || server_io(fd, frame, sizeof(*frame), 0))
+		return -1;
+
+	if (frame->magic != SERVER_MAGIC || frame->channels > MAX_REAL_CHANNELS || frame->columns > req.columns) {
+		error("Not a compatible frame server");
+		return -1;
+	}
+
+	return server_io(fd, out, (size_t)frame->columns * frame->channels * sizeof(*out), 0);
+}
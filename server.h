@@ -0,0 +1,83 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_SERVER_H
+#define __VOLTLOGGER_SERVER_H
+
+#include <stdint.h>
+
+#include "history.h"
+
+/*
+ * Frame server for thin remote viewers (-W): instead of the records, a
+ * client gets the min/max of every channel per pixel column of the frame
+ * it's going to draw, so the bandwidth depends on the window width, not on
+ * the sample rate. The address is "unix:<path>" or "tcp:[<host>:]<port>".
+ *
+ * The protocol is a request/response exchange of fixed-size structures in
+ * the host byte order (as the binlog), the magic tells a mismatch:
+ *
+ *	client: server_request_t
+ *	server: server_frame_t, then server_column_t[columns][channels]
+ *
+ * A live frame is the last "from" records aligned to the trigger events as
+ * in the local view, a range frame is the records with timestamps in
+ * [from; to). An empty column has min > max; a frame of 0 columns means
+ * there was nothing to send.
+ */
+
+#define SERVER_MAGIC		0x31565246	/* "FRV1" */
+#define SERVER_COLUMNS_MAX	4096
+#define SERVER_CLIENTS_MAX	16
+#define SERVER_TIMEOUT_MSECS	500		/* a peer stalling a transfer longer is dropped */
+
+enum server_frame_type {
+	SERVER_FRAME_LIVE = 0,
+	SERVER_FRAME_RANGE,
+};
+
+typedef struct {
+	uint32_t magic;
+	uint16_t type;
+	uint16_t columns;
+	uint64_t from;
+	uint64_t to;
+} server_request_t;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t channels;
+	uint16_t columns;
+	uint64_t ts_start;
+	uint64_t ts_end;
+	uint64_t records;
+} server_frame_t;
+
+typedef struct {
+	uint16_t min;
+	uint16_t max;
+} server_column_t;
+
+extern int  server_start(const char *address, int channels);
+extern void server_stop();
+
+extern int  server_connect(const char *address);
+extern int  server_request_frame(int fd, enum server_frame_type type, int columns, uint64_t from, uint64_t to, server_frame_t *frame, server_column_t *out);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "macros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stats.h"
+#include "pthreadex.h"
+#include "error.h"
+
+uint64_t          stats_counters  [STATS_COUNTER_MAX];
+stats_histogram_t stats_histograms[STATS_HISTOGRAM_MAX];
+
+static const char *const stats_counter_names[STATS_COUNTER_MAX] = {
+	[STATS_RECORDS]		= "records",
+	[STATS_RESYNC_BYTES]	= "resync_bytes",
+	[STATS_FLUSHES]		= "flushes",
+	[STATS_FRAMES]		= "frames",
+	[STATS_SYNC_FAILURES]	= "sync_failures",
+	[STATS_FRAMES_REUSED]	= "frames_reused",
+	[STATS_TILES_RENDERED]	= "tiles_rendered",
+	[STATS_TILES_REUSED]	= "tiles_reused",
+	[STATS_TRIGGERS]	= "triggers",
+	[STATS_GAPS]		= "gaps",
+	[STATS_OVERLOADS]	= "overloads",
+	[STATS_DECIMATED_RECORDS]	= "decimated_records",
+	[STATS_BACKLOG_BYTES]	= "backlog_bytes",
+	[STATS_FRAMES_SERVED]	= "frames_served",
+	[STATS_SERVED_BYTES]	= "served_bytes",
+};
+
+static const char *const stats_histogram_names[STATS_HISTOGRAM_MAX] = {
+	[STATS_H_DRAW]		= "draw_ns",
+	[STATS_H_TRIGGER]	= "trigger_ns",
+	[STATS_H_FLUSH]		= "flush_ns",
+	[STATS_H_REPLAY_LAG]	= "replay_lag_ns",
+};
+
+static int         stats_pipe[2]    = {-1, -1};
+static int         stats_socket     = -1;
+static const char *stats_socketpath = NULL;
+static pthread_t   stats_thread;
+
+/* Returns the upper bound of the bucket containing the "q" quantile */
+uint64_t stats_quantile(stats_histogram_t *h, uint64_t count, double q) {
+	uint64_t sum = 0;
+	int i = 0;
+
+	if (!count)
+		return 0;
+
+	while (i < STATS_BUCKETS) {
+		sum += __atomic_load_n(&h->bucket[i], __ATOMIC_RELAXED);
+		if (sum > q * count)
+			return (uint64_t)1 << i;
+		i++;
+	}
+
+	return (uint64_t)1 << (STATS_BUCKETS - 1);
+}
+
+void stats_dump_histogram(int fd, const char *name, stats_histogram_t *h) {
+	uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+	uint64_t sum   = __atomic_load_n(&h->sum,   __ATOMIC_RELAXED);
+
+	dprintf(fd, "%s count=%lu avg=%lu p50<%lu p99<%lu max=%lu\n",
+		name, count, count ? sum/count : 0,
+		stats_quantile(h, count, 0.5), stats_quantile(h, count, 0.99),
+		__atomic_load_n(&h->max, __ATOMIC_RELAXED));
+}
+
+void stats_dump(int fd) {
+	int i;
+
+	i = 0;
+	while (i < STATS_COUNTER_MAX) {
+		dprintf(fd, "%s %lu\n", stats_counter_names[i], __atomic_load_n(&stats_counters[i], __ATOMIC_RELAXED));
+		i++;
+	}
+
+	i = 0;
+	while (i < STATS_HISTOGRAM_MAX) {
+		stats_dump_histogram(fd, stats_histogram_names[i], &stats_histograms[i]);
+		i++;
+	}
+
+	pthread_lockstat_t *site = __atomic_load_n(&pthread_lockstat_list, __ATOMIC_ACQUIRE);
+	while (site != NULL) {
+		char name[BUFSIZ];
+
+		dprintf(fd, "lock %s acquired=%lu contended=%lu timedout=%lu\n", site->name,
+			__atomic_load_n(&site->acquired,  __ATOMIC_RELAXED),
+			__atomic_load_n(&site->contended, __ATOMIC_RELAXED),
+			__atomic_load_n(&site->timedout,  __ATOMIC_RELAXED));
+		snprintf(name, sizeof(name), "lock %s wait_ns", site->name);
+		stats_dump_histogram(fd, name, &site->wait);
+		snprintf(name, sizeof(name), "lock %s hold_ns", site->name);
+		stats_dump_histogram(fd, name, &site->hold);
+		site = site->next;
+	}
+}
+
+static void stats_sigusr1(int signum) {
+	int saved_errno = errno;
+	char c = 0;
+
+	if (write(stats_pipe[1], &c, 1) < 0) {
+		/* The pipe is full: a dump is already pending */
+	}
+
+	errno = saved_errno;
+}
+
+static void *stats_handler(void *arg) {
+	struct pollfd fds[2];
+
+	fds[0].fd     = stats_pipe[0];
+	fds[0].events = POLLIN;
+	fds[1].fd     = stats_socket;
+	fds[1].events = POLLIN;
+
+	while (1) {
+		if (poll(fds, stats_socket == -1 ? 1 : 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			error("Got error from poll()");
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			char buf[64];
+			if (read(stats_pipe[0], buf, sizeof(buf)) > 0)
+				stats_dump(STDERR);
+		}
+
+		if (stats_socket != -1 && (fds[1].revents & POLLIN)) {
+			int client = accept(stats_socket, NULL, NULL);
+			if (client != -1) {
+				stats_dump(client);
+				close(client);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+int stats_init(const char *socketpath) {
+	struct sigaction sa;
+
+	if (pipe2(stats_pipe, O_NONBLOCK | O_CLOEXEC)) {
+		error("Cannot create a pipe");
+		return -1;
+	}
+
+	if (socketpath != NULL) {
+		struct sockaddr_un addr;
+
+		if (strlen(socketpath) >= sizeof(addr.sun_path)) {
+			error("Too long socket path: \"%s\"", socketpath);
+			return -1;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, socketpath);
+
+		stats_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		unlink(socketpath);
+		if (stats_socket == -1 ||
+		    bind(stats_socket, (struct sockaddr *)&addr, sizeof(addr)) ||
+		    listen(stats_socket, 4)) {
+			error("Cannot listen on \"%s\"", socketpath);
+			return -1;
+		}
+		stats_socketpath = socketpath;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stats_sigusr1;
+	sa.sa_flags   = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, NULL)) {
+		error("Cannot set SIGUSR1 handler");
+		return -1;
+	}
+
+	if (pthread_create(&stats_thread, NULL, stats_handler, NULL)) {
+		error("Cannot create a thread");
+		return -1;
+	}
+
+	return 0;
+}
+
+void stats_deinit() {
+	pthread_cancel(stats_thread);
+	pthread_join(stats_thread, NULL);
+
+	if (stats_socket != -1) {
+		close(stats_socket);
+		unlink(stats_socketpath);
+	}
+
+	signal(SIGUSR1, SIG_DFL);
+	close(stats_pipe[0]);
+	close(stats_pipe[1]);
+}
@@ -0,0 +1,114 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_STATS_H
+#define __VOLTLOGGER_STATS_H
+
+#include <stdint.h>	/* uint64_t	*/
+#include <time.h>	/* clock_gettime()	*/
+
+/*
+ * Runtime counters and latency histograms. Updates are relaxed atomic
+ * increments, so they are cheap enough to be always enabled. The values
+ * are dumped to stderr on SIGUSR1 and to anybody connecting to the stats
+ * Unix socket (see "-S").
+ */
+
+enum stats_counter {
+	STATS_RECORDS = 0,
+	STATS_RESYNC_BYTES,
+	STATS_FLUSHES,
+	STATS_FRAMES,
+	STATS_SYNC_FAILURES,
+	STATS_FRAMES_REUSED,
+	STATS_TILES_RENDERED,
+	STATS_TILES_REUSED,
+	STATS_TRIGGERS,
+	STATS_GAPS,
+	STATS_OVERLOADS,
+	STATS_DECIMATED_RECORDS,
+	STATS_BACKLOG_BYTES,		/* gauge */
+	STATS_FRAMES_SERVED,
+	STATS_SERVED_BYTES,
+
+	STATS_COUNTER_MAX
+};
+
+enum stats_histogram {
+	STATS_H_DRAW = 0,
+	STATS_H_TRIGGER,
+	STATS_H_FLUSH,
+	STATS_H_REPLAY_LAG,
+
+	STATS_HISTOGRAM_MAX
+};
+
+/* Bucket "i" counts durations in [2^(i-1); 2^i) nanoseconds */
+#define STATS_BUCKETS	40
+
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t bucket[STATS_BUCKETS];
+} stats_histogram_t;
+
+extern uint64_t          stats_counters  [STATS_COUNTER_MAX];
+extern stats_histogram_t stats_histograms[STATS_HISTOGRAM_MAX];
+
+static inline uint64_t stats_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000*1000*1000 + ts.tv_nsec;
+}
+
+static inline void stats_inc(enum stats_counter counter, uint64_t n) {
+	__atomic_fetch_add(&stats_counters[counter], n, __ATOMIC_RELAXED);
+}
+
+static inline void stats_set(enum stats_counter counter, uint64_t value) {
+	__atomic_store_n(&stats_counters[counter], value, __ATOMIC_RELAXED);
+}
+
+static inline void stats_record(stats_histogram_t *h, uint64_t ns) {
+	int bucket = 64 - __builtin_clzll(ns | 1);
+
+	if (bucket >= STATS_BUCKETS)
+		bucket = STATS_BUCKETS - 1;
+
+	__atomic_fetch_add(&h->bucket[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+
+	/* A lost update of "max" is acceptable */
+	if (ns > __atomic_load_n(&h->max, __ATOMIC_RELAXED))
+		__atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+}
+
+static inline void stats_time(enum stats_histogram histogram, uint64_t since) {
+	stats_record(&stats_histograms[histogram], stats_now() - since);
+}
+
+extern uint64_t stats_quantile(stats_histogram_t *h, uint64_t count, double q);
+extern void stats_dump_histogram(int fd, const char *name, stats_histogram_t *h);
+extern void stats_dump(int fd);
+extern int  stats_init(const char *socketpath);
+extern void stats_deinit();
+
+#endif
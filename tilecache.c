@@ -0,0 +1,259 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <cairo.h>
+
+#include "tilecache.h"
+#include "malloc.h"
+#include "stats.h"
+
+typedef struct {
+	int       zoom;
+	int64_t   index;			/* tile start == index * TILE_WIDTH << zoom */
+	int       chan;
+	int       height;
+	float     y_offset;
+	float     y_scale;
+} tile_key_t;
+
+typedef struct {
+	tile_key_t       key;
+	char             used;
+	char             complete;		/* the tile ends before the latest record */
+	uint64_t         ts_latest;		/* for incomplete tiles */
+	uint64_t         last_used;
+	cairo_surface_t *surface;		/* CAIRO_FORMAT_A8 mask */
+} tile_t;
+
+static tile_t   *tilecache       = NULL;
+static int       tilecache_size  = 0;
+static uint64_t  tilecache_clock = 0;
+static uint64_t  tilecache_generation = 0;	/* of the history the tiles are rendered from */
+
+static inline int tile_key_equal(const tile_key_t *a, const tile_key_t *b) {
+	return	a->zoom     == b->zoom     &&
+		a->index    == b->index    &&
+		a->chan     == b->chan     &&
+		a->height   == b->height   &&
+		a->y_offset == b->y_offset &&
+		a->y_scale  == b->y_scale;
+}
+
+static tile_t *tilecache_lookup(const tile_key_t *key, const history_snapshot_t *snap) {
+	int i = 0;
+
+	while (i < tilecache_size) {
+		tile_t *tile = &tilecache[i++];
+
+		if (!tile->used || !tile_key_equal(&tile->key, key))
+			continue;
+
+		// Only the tiles touching the newly arrived data are invalidated
+		if (!tile->complete && tile->ts_latest != snap->ts_latest)
+			return NULL;
+
+		tile->last_used = ++tilecache_clock;
+		return tile;
+	}
+
+	return NULL;
+}
+
+static tile_t *tilecache_slot(const tile_key_t *key) {
+	tile_t *victim = &tilecache[0];
+	int i = 0;
+
+	while (i < tilecache_size) {
+		tile_t *tile = &tilecache[i++];
+
+		if (tile->used && tile_key_equal(&tile->key, key))
+			return tile;
+
+		if (!tile->used) {
+			victim = tile;
+			break;
+		}
+
+		if (tile->last_used < victim->last_used)
+			victim = tile;
+	}
+
+	if (victim->surface == NULL || victim->key.height != key->height) {
+		if (victim->surface != NULL)
+			cairo_surface_destroy(victim->surface);
+		victim->surface = cairo_image_surface_create(CAIRO_FORMAT_A8, TILE_WIDTH, key->height);
+	}
+	victim->used = 0;
+	return victim;
+}
+
+/* Returns 0 if history_flush() moved the records while rendering */
+static int tile_render(tile_t *tile, const tile_key_t *key, const history_snapshot_t *snap) {
+	int64_t  tile_units = (int64_t)TILE_WIDTH << key->zoom;
+	uint64_t ts_a = key->index * tile_units;
+	uint64_t ts_b = ts_a + tile_units;
+	uint64_t i, end;
+	cairo_t *cr = cairo_create(tile->surface);
+
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_rgba(cr, 0, 0, 0, 0);
+	cairo_paint(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+	i   = history_find(ts_a, 0, snap->length);
+	end = history_find(ts_b, i, snap->length);
+	// One more record on each side to connect the neighbouring tiles
+	if (i > 0)
+		i--;
+	if (end < snap->length)
+		end++;
+
+	if (i < end) {
+		cairo_set_line_width(cr, 2);
+		cairo_set_source_rgba(cr, 0, 0, 0, 0.8);
+		uint64_t gap = history_gap_next(i, end);
+
+		cairo_move_to(cr, (double)((int64_t)(history[i].timestamp - ts_a)) / ((int64_t)1 << key->zoom), key->y_offset - key->y_scale * history[i].value[key->chan]);
+		while (++i < end) {
+			double x = (double)((int64_t)(history[i].timestamp - ts_a)) / ((int64_t)1 << key->zoom);
+			double y = key->y_offset - key->y_scale * history[i].value[key->chan];
+
+			// Lost samples: don't connect the records across the gap
+			if (i == gap) {
+				cairo_move_to(cr, x, y);
+				gap = history_gap_next(i, end);
+			} else
+				cairo_line_to(cr, x, y);
+		}
+		cairo_stroke(cr);
+	}
+	cairo_destroy(cr);
+	cairo_surface_flush(tile->surface);
+
+	if (!history_snapshot_valid(snap))
+		return 0;
+
+	tile->key       = *key;
+	tile->used      = 1;
+	tile->complete  = ts_b <= snap->ts_latest;
+	tile->ts_latest = snap->ts_latest;
+	tile->last_used = ++tilecache_clock;
+	return 1;
+}
+
+/* Grows the cache to TILECACHE_SCREENS screens of the enabled channels */
+static void tilecache_reserve(const tilecache_view_t *v) {
+	int size = 0;
+	int chan = 0;
+
+	while (chan < v->channels) {
+		if (v->enabled[chan])
+			size += (v->width + TILE_WIDTH - 1) / TILE_WIDTH + 1;
+		chan++;
+	}
+	size *= TILECACHE_SCREENS;
+
+	if (size <= tilecache_size)
+		return;
+
+	tilecache = xrealloc(tilecache, size * sizeof(*tilecache));
+	memset(&tilecache[tilecache_size], 0, (size - tilecache_size) * sizeof(*tilecache));
+	tilecache_size = size;
+}
+
+int tilecache_draw(cairo_t *cr, const tilecache_view_t *v, const history_snapshot_t *snap) {
+	int64_t tile_units = (int64_t)TILE_WIDTH << v->zoom;
+	int64_t first = v->ts_start / tile_units;
+	int64_t last  = (v->ts_start + ((uint64_t)v->width << v->zoom)) / tile_units;
+	int consistent = 1;
+	int chan = 0;
+
+	// The records have moved (history_flush(), history_prepend()), every tile may be stale
+	if (snap->generation != tilecache_generation) {
+		int i = 0;
+
+		while (i < tilecache_size)
+			tilecache[i++].used = 0;
+		tilecache_generation = snap->generation;
+	}
+
+	tilecache_reserve(v);
+
+	while (chan < v->channels) {
+		if (!v->enabled[chan]) {
+			chan++;
+			continue;
+		}
+
+		cairo_set_source_rgb(cr, v->color[chan][0], v->color[chan][1], v->color[chan][2]);
+
+		int64_t index = first;
+		while (index <= last) {
+			tile_key_t key;
+			tile_t *tile;
+
+			memset(&key, 0, sizeof(key));
+			key.zoom     = v->zoom;
+			key.index    = index;
+			key.chan     = chan;
+			key.height   = v->height;
+			key.y_offset = v->y_offset[chan];
+			key.y_scale  = v->y_scale[chan];
+
+			tile = tilecache_lookup(&key, snap);
+			if (tile == NULL) {
+				tile = tilecache_slot(&key);
+				stats_inc(STATS_TILES_RENDERED, 1);
+				if (!tile_render(tile, &key, snap)) {
+					consistent = 0;
+					index++;
+					continue;
+				}
+			} else {
+				stats_inc(STATS_TILES_REUSED, 1);
+			}
+
+			cairo_mask_surface(cr, tile->surface, (double)((int64_t)(index * tile_units - v->ts_start) >> v->zoom), 0);
+			index++;
+		}
+
+		chan++;
+	}
+
+	return consistent;
+}
+
+/* Releases the tiles, e.g. when the browsing ends */
+void tilecache_flush() {
+	int i = 0;
+
+	while (i < tilecache_size) {
+		if (tilecache[i].surface != NULL)
+			cairo_surface_destroy(tilecache[i].surface);
+		i++;
+	}
+
+	free(tilecache);
+	tilecache      = NULL;
+	tilecache_size = 0;
+}
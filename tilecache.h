@@ -0,0 +1,53 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_TILECACHE_H
+#define __VOLTLOGGER_TILECACHE_H
+
+#include <cairo.h>
+
+#include "history.h"
+
+/*
+ * Rendered waveform tiles for browsing the history: a tile is TILE_WIDTH
+ * pixels of one channel at one zoom level (2^zoom timestamp units per
+ * pixel), aligned to absolute timestamps, so panning only renders the newly
+ * exposed tiles and returning to a zoom level reuses its tiles.
+ */
+
+#define TILE_WIDTH		256
+/* The cache holds this many screens of tiles of the enabled channels */
+#define TILECACHE_SCREENS	8
+
+typedef struct {
+	int       zoom;
+	uint64_t  ts_start;			/* at x == 0, multiple of 2^zoom */
+	int       width;
+	int       height;
+	int       channels;
+	char      enabled [MAX_REAL_CHANNELS];
+	float     y_offset[MAX_REAL_CHANNELS];
+	float     y_scale [MAX_REAL_CHANNELS];
+	double    color   [MAX_REAL_CHANNELS][3];
+} tilecache_view_t;
+
+extern int  tilecache_draw(cairo_t *cr, const tilecache_view_t *v, const history_snapshot_t *snap);
+extern void tilecache_flush();
+
+#endif
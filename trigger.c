@@ -0,0 +1,295 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trigger.h"
+#include "error.h"
+#include "stats.h"
+
+/* Defaults match the former per-frame search: the value falls below 675 */
+trigger_config_t trigger_config = {
+	.mode       = TRIGGER_EDGE,
+	.slope      = TRIGGER_FALL,
+	.channel    = 0,
+	.level      = 675,
+	.level_high = 675,
+};
+
+static struct {
+	char     initialized;
+	char     high;		/* comparator output			*/
+	char     inside;	/* window: within [level; level_high]	*/
+	char     armed;		/* pulse: the starting edge was seen	*/
+	char     reached;	/* runt: the second level was reached	*/
+	char     fired;
+	uint64_t ts_edge;
+	uint64_t ts_fired;
+} trigger_state;
+
+static uint64_t trigger_events[TRIGGER_EVENTS];
+static uint64_t trigger_head = 0;
+
+/*
+ * Parses "mode[,option=value...]", e.g. "pulse,slope=rise,level=700,min=1000".
+ * Returns 0 on success.
+ */
+int trigger_parse(char *spec) {
+	char *const modes[] = {
+		[TRIGGER_EDGE]   = "edge",
+		[TRIGGER_PULSE]  = "pulse",
+		[TRIGGER_WINDOW] = "window",
+		[TRIGGER_RUNT]   = "runt",
+		NULL
+	};
+	enum {
+		OPT_CHANNEL = 0,
+		OPT_SLOPE,
+		OPT_LEVEL,
+		OPT_HIGH,
+		OPT_HYST,
+		OPT_MIN,
+		OPT_MAX,
+		OPT_HOLDOFF,
+	};
+	char *const options[] = {
+		[OPT_CHANNEL] = "channel",
+		[OPT_SLOPE]   = "slope",
+		[OPT_LEVEL]   = "level",
+		[OPT_HIGH]    = "high",
+		[OPT_HYST]    = "hyst",
+		[OPT_MIN]     = "min",
+		[OPT_MAX]     = "max",
+		[OPT_HOLDOFF] = "holdoff",
+		NULL
+	};
+	trigger_config_t c = trigger_config;
+	char *value;
+	int mode;
+
+	mode = getsubopt(&spec, modes, &value);
+	if (mode < 0 || value != NULL) {
+		error("Unknown trigger mode \"%s\"", value != NULL ? value : spec);
+		return EINVAL;
+	}
+	c.mode = mode;
+
+	while (*spec) {
+		int opt = getsubopt(&spec, options, &value);
+
+		if (opt >= 0 && value == NULL) {
+			error("Trigger option \"%s\" requires a value", options[opt]);
+			return EINVAL;
+		}
+
+		switch (opt) {
+			case OPT_CHANNEL:
+				c.channel    = atoi(value);
+				break;
+			case OPT_SLOPE:
+				if (!strcmp(value, "rise"))
+					c.slope = TRIGGER_RISE;
+				else if (!strcmp(value, "fall"))
+					c.slope = TRIGGER_FALL;
+				else {
+					error("Unknown trigger slope \"%s\"", value);
+					return EINVAL;
+				}
+				break;
+			case OPT_LEVEL:
+				c.level      = strtoul (value, NULL, 0);
+				break;
+			case OPT_HIGH:
+				c.level_high = strtoul (value, NULL, 0);
+				break;
+			case OPT_HYST:
+				c.hysteresis = strtoul (value, NULL, 0);
+				break;
+			case OPT_MIN:
+				c.width_min  = strtoull(value, NULL, 0);
+				break;
+			case OPT_MAX:
+				c.width_max  = strtoull(value, NULL, 0);
+				break;
+			case OPT_HOLDOFF:
+				c.holdoff    = strtoull(value, NULL, 0);
+				break;
+			default:
+				error("Unknown trigger option \"%s\"", value);
+				return EINVAL;
+		}
+	}
+
+	if (c.channel < 0 || c.channel >= MAX_REAL_CHANNELS) {
+		error("Trigger channel %i is out of range", c.channel);
+		return EINVAL;
+	}
+
+	if ((c.mode == TRIGGER_WINDOW || c.mode == TRIGGER_RUNT) && c.level_high < c.level) {
+		error("Trigger level %u is higher than %u", c.level, c.level_high);
+		return EINVAL;
+	}
+
+	trigger_config = c;
+	return 0;
+}
+
+/* Comparator with hysteresis: switches high at "level", back low below "level - hyst" */
+static inline char trigger_compare(char high, uint32_t value, uint32_t level, uint32_t hyst) {
+	if (high)
+		return value + hyst >= level;
+
+	return value >= level;
+}
+
+static inline void trigger_emit(uint64_t ts) {
+	uint64_t head = __atomic_load_n(&trigger_head, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&trigger_events[head % TRIGGER_EVENTS], ts, __ATOMIC_RELAXED);
+	__atomic_store_n(&trigger_head, head + 1, __ATOMIC_RELEASE);
+	stats_inc(STATS_TRIGGERS, 1);
+}
+
+/* Returns 1 if the record fired the trigger */
+int trigger_feed(const history_t *p) {
+	const trigger_config_t *c = &trigger_config;
+	uint32_t value = p->value[c->channel];
+	uint64_t ts    = p->timestamp;
+	char     fire  = 0;
+	char     high;
+
+	// Runt triggers of the falling slope watch the upper level
+	uint32_t level = c->mode == TRIGGER_RUNT && c->slope == TRIGGER_FALL ? c->level_high : c->level;
+
+	if (unlikely(!trigger_state.initialized)) {
+		trigger_state.high    = value >= level;
+		trigger_state.inside  = value >= c->level && value <= c->level_high;
+		trigger_state.reached = 1;
+		trigger_state.initialized = 1;
+		return 0;
+	}
+
+	high = trigger_compare(trigger_state.high, value, level, c->hysteresis);
+
+	switch (c->mode) {
+		case TRIGGER_EDGE:
+			if (c->slope == TRIGGER_RISE)
+				fire = high && !trigger_state.high;
+			else
+				fire = !high && trigger_state.high;
+			break;
+		case TRIGGER_PULSE:
+			if (high == trigger_state.high)
+				break;
+
+			if (high == (c->slope == TRIGGER_RISE)) {
+				trigger_state.armed   = 1;
+				trigger_state.ts_edge = ts;
+			} else if (trigger_state.armed) {
+				uint64_t width = ts - trigger_state.ts_edge;
+
+				fire = width >= c->width_min && (!c->width_max || width <= c->width_max);
+				trigger_state.armed = 0;
+			}
+			break;
+		case TRIGGER_WINDOW: {
+			char inside = value >= c->level && value <= c->level_high;
+
+			fire = trigger_state.inside && !inside;
+			trigger_state.inside = inside;
+			break;
+		}
+		case TRIGGER_RUNT:
+			if (c->slope == TRIGGER_RISE) {
+				if (high && !trigger_state.high)
+					trigger_state.reached = 0;
+				if (high && value >= c->level_high)
+					trigger_state.reached = 1;
+				fire = !high && trigger_state.high && !trigger_state.reached;
+			} else {
+				if (!high && trigger_state.high)
+					trigger_state.reached = 0;
+				if (!high && value <= c->level)
+					trigger_state.reached = 1;
+				fire = high && !trigger_state.high && !trigger_state.reached;
+			}
+			break;
+	}
+
+	trigger_state.high = high;
+
+	if (!fire)
+		return 0;
+
+	if (trigger_state.fired && ts - trigger_state.ts_fired < c->holdoff)
+		return 0;
+
+	trigger_state.fired    = 1;
+	trigger_state.ts_fired = ts;
+	trigger_emit(ts);
+	return 1;
+}
+
+/*
+ * Finds the first and the last events within [ts_from; ts_to], looking
+ * through the whole ring but its oldest slot, the next one to be written
+ * (the last TRIGGER_EVENTS-1 events). Returns the number of events found,
+ * 0 if the writer keeps overwriting the oldest of them while they're read.
+ */
+int trigger_find(uint64_t ts_from, uint64_t ts_to, uint64_t *ts_first, uint64_t *ts_last) {
+	int tries = 3;
+
+	while (tries--) {
+		uint64_t head  = __atomic_load_n(&trigger_head, __ATOMIC_ACQUIRE);
+		uint64_t i     = head;
+		uint64_t first = head;
+		int found = 0;
+
+		while (i > 0 && head - i < TRIGGER_EVENTS - 1) {
+			uint64_t ts = __atomic_load_n(&trigger_events[(i - 1) % TRIGGER_EVENTS], __ATOMIC_RELAXED);
+
+			if (ts < ts_from)
+				break;
+
+			if (ts <= ts_to) {
+				if (!found)
+					*ts_last = ts;
+				*ts_first = ts;
+				first     = i - 1;
+				found++;
+			}
+
+			i--;
+		}
+
+		// Event "first" is overwritten by event first + TRIGGER_EVENTS, which
+		// may be being written while the head is still at it
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (!found || __atomic_load_n(&trigger_head, __ATOMIC_RELAXED) - first < TRIGGER_EVENTS)
+			return found;
+	}
+
+	return 0;
+}
@@ -0,0 +1,68 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_TRIGGER_H
+#define __VOLTLOGGER_TRIGGER_H
+
+#include <stdint.h>
+
+#include "history.h"
+
+/*
+ * Streaming trigger engine. trigger_feed() is called once per ingested
+ * record (by a single thread) and runs a small state machine, so every
+ * trigger kind costs O(1) per sample. Events (timestamps of the records
+ * that fired) are kept in a ring that the display and other consumers
+ * query with trigger_find().
+ */
+
+/* Length of the event ring, should be a power of 2 */
+#define TRIGGER_EVENTS	4096
+
+enum trigger_mode {
+	TRIGGER_EDGE = 0,	/* the signal crosses "level"				*/
+	TRIGGER_PULSE,		/* a pulse between crossings is [width_min; width_max] long	*/
+	TRIGGER_WINDOW,		/* the signal leaves [level; level_high]			*/
+	TRIGGER_RUNT,		/* a pulse crosses one of the levels, but not the other	*/
+};
+
+enum trigger_slope {
+	TRIGGER_RISE = 0,
+	TRIGGER_FALL,
+};
+
+typedef struct {
+	enum trigger_mode  mode;
+	enum trigger_slope slope;
+	int      channel;
+	uint32_t level;
+	uint32_t level_high;		/* window and runt only			*/
+	uint32_t hysteresis;
+	uint64_t width_min;		/* pulse only, in timestamp units	*/
+	uint64_t width_max;		/* 0 -- unlimited			*/
+	uint64_t holdoff;		/* minimal interval between events	*/
+} trigger_config_t;
+
+extern trigger_config_t trigger_config;
+
+extern int  trigger_parse(char *spec);
+extern int  trigger_feed(const history_t *p);
+extern int  trigger_find(uint64_t ts_from, uint64_t ts_to, uint64_t *ts_first, uint64_t *ts_last);
+
+#endif
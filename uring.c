@@ -0,0 +1,163 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "macros.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static inline int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Returns 0 on success or -1 (with errno) if io_uring isn't available */
+int uring_init(uring_t *u, unsigned entries) {
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0)
+		return -1;
+
+	u->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_map_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->sq_map_size = u->cq_map_size = MAX(u->sq_map_size, u->cq_map_size);
+
+	u->sq_map = mmap(NULL, u->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_map == MAP_FAILED)
+		goto l_error_close;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_map = u->sq_map;
+	} else {
+		u->cq_map = mmap(NULL, u->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_map == MAP_FAILED)
+			goto l_error_unmap_sq;
+	}
+
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		goto l_error_unmap_cq;
+
+	sq = u->sq_map;
+	u->sq_head    = (unsigned *)(sq + p.sq_off.head);
+	u->sq_tail    = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask    = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+	u->sq_array   = (unsigned *)(sq + p.sq_off.array);
+
+	cq = u->cq_map;
+	u->cq_head    = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail    = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask    = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes       = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+
+l_error_unmap_cq:
+	if (u->cq_map != u->sq_map)
+		munmap(u->cq_map, u->cq_map_size);
+l_error_unmap_sq:
+	munmap(u->sq_map, u->sq_map_size);
+l_error_close:
+	close(u->fd);
+	u->fd = -1;
+	return -1;
+}
+
+int uring_register_buffers(uring_t *u, const struct iovec *iov, unsigned count) {
+	return syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, iov, count);
+}
+
+/* Returns a cleared SQE to fill in, or NULL if the submission queue is full */
+struct io_uring_sqe *uring_get_sqe(uring_t *u) {
+	unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *u->sq_tail + u->sq_pending;
+	unsigned idx;
+
+	if (tail - head >= *u->sq_entries)
+		return NULL;
+
+	idx = tail & *u->sq_mask;
+	u->sq_array[idx] = idx;
+	u->sq_pending++;
+	memset(&u->sqes[idx], 0, sizeof(u->sqes[idx]));
+	return &u->sqes[idx];
+}
+
+/*
+ * Submits the prepared SQEs, and the ones a partial submission left in the
+ * ring. Returns the number submitted or -1.
+ */
+int uring_submit(uring_t *u) {
+	unsigned tail = *u->sq_tail + u->sq_pending;
+	unsigned n;
+	int rc;
+
+	__atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+	u->sq_pending = 0;
+
+	n = tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (!n)
+		return 0;
+
+	do {
+		rc = uring_enter(u->fd, n, 0, 0);
+	} while (rc < 0 && errno == EINTR);
+
+	return rc;
+}
+
+/* Waits for a completion and copies it to "cqe" */
+int uring_wait(uring_t *u, struct io_uring_cqe *cqe) {
+	while (1) {
+		unsigned head = *u->cq_head;
+
+		if (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+			*cqe = u->cqes[head & *u->cq_mask];
+			__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+			return 0;
+		}
+
+		if (uring_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+			return -1;
+	}
+}
+
+void uring_deinit(uring_t *u) {
+	if (u->fd < 0)
+		return;
+
+	munmap(u->sqes, u->sqes_size);
+	if (u->cq_map != u->sq_map)
+		munmap(u->cq_map, u->cq_map_size);
+	munmap(u->sq_map, u->sq_map_size);
+	close(u->fd);
+	u->fd = -1;
+}
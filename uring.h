@@ -0,0 +1,62 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_URING_H
+#define __VOLTLOGGER_URING_H
+
+#include <stdint.h>
+#include <sys/uio.h>		/* struct iovec	*/
+#include <linux/io_uring.h>
+
+/*
+ * A minimal io_uring wrapper over the raw system calls (no liburing): one
+ * submitter thread, which is also the only one reaping the completions.
+ */
+
+typedef struct {
+	int			 fd;
+	unsigned		 sq_pending;	/* prepared, but not submitted yet */
+
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		*sq_mask;
+	unsigned		*sq_entries;
+	unsigned		*sq_array;
+	struct io_uring_sqe	*sqes;
+
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void			*sq_map;
+	size_t			 sq_map_size;
+	void			*cq_map;
+	size_t			 cq_map_size;
+	size_t			 sqes_size;
+} uring_t;
+
+extern int  uring_init(uring_t *u, unsigned entries);
+extern int  uring_register_buffers(uring_t *u, const struct iovec *iov, unsigned count);
+extern struct io_uring_sqe *uring_get_sqe(uring_t *u);
+extern int  uring_submit(uring_t *u);
+extern int  uring_wait(uring_t *u, struct io_uring_cqe *cqe);
+extern void uring_deinit(uring_t *u);
+
+#endif
@@ -0,0 +1,159 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <cairo.h>
+
+#include "xy.h"
+#include "error.h"
+
+xy_config_t xy_config = {
+	.x           = 0,
+	.y           = 1,
+	.persistence = XY_PERSISTENCE_DEFAULT,
+};
+char     xy_enabled = 0;
+uint32_t xy_hits[XY_BINS * XY_BINS];
+
+/* The draw side: the hits already folded into the density */
+static uint32_t         xy_seen   [XY_BINS * XY_BINS];
+static float            xy_density[XY_BINS * XY_BINS];
+static uint32_t         xy_pixels [XY_BINS * XY_BINS];
+static cairo_surface_t *xy_surface = NULL;
+
+/*
+ * Parses "x=<channel>,y=<channel>[,persistence=<0..1>]" and enables the
+ * XY display. Returns 0 on success.
+ */
+int xy_parse(char *spec) {
+	enum {
+		OPT_X = 0,
+		OPT_Y,
+		OPT_PERSISTENCE,
+	};
+	char *const options[] = {
+		[OPT_X]           = "x",
+		[OPT_Y]           = "y",
+		[OPT_PERSISTENCE] = "persistence",
+		NULL
+	};
+	xy_config_t c = xy_config;
+	char *value;
+
+	while (*spec) {
+		int opt = getsubopt(&spec, options, &value);
+
+		if (opt >= 0 && value == NULL) {
+			error("XY option \"%s\" requires a value", options[opt]);
+			return EINVAL;
+		}
+
+		switch (opt) {
+			case OPT_X:
+				c.x           = atoi(value);
+				break;
+			case OPT_Y:
+				c.y           = atoi(value);
+				break;
+			case OPT_PERSISTENCE:
+				c.persistence = atof(value);
+				break;
+			default:
+				error("Unknown XY option \"%s\"", value);
+				return EINVAL;
+		}
+	}
+
+	if (c.x < 0 || c.x >= MAX_REAL_CHANNELS || c.y < 0 || c.y >= MAX_REAL_CHANNELS) {
+		error("XY channels should be in [0; %u)", MAX_REAL_CHANNELS);
+		return EINVAL;
+	}
+
+	if (c.persistence < 0 || c.persistence > 1) {
+		error("XY persistence should be in [0; 1]");
+		return EINVAL;
+	}
+
+	xy_config  = c;
+	xy_enabled = 1;
+	return 0;
+}
+
+/*
+ * Renders the density scaled to width x height. The brightness is
+ * logarithmic, so rarely visited bins stay visible next to the dense ones.
+ */
+void xy_draw(cairo_t *cr, int width, int height, const double color[3]) {
+	const float persistence = xy_config.persistence;
+	float density_max = 0, scale;
+	uint32_t rgb[3];
+	int i;
+
+	if (xy_surface == NULL)
+		xy_surface = cairo_image_surface_create_for_data((unsigned char *)xy_pixels, CAIRO_FORMAT_ARGB32, XY_BINS, XY_BINS, XY_BINS * sizeof(uint32_t));
+
+	i = 0;
+	while (i < XY_BINS * XY_BINS) {
+		uint32_t hits  = __atomic_load_n(&xy_hits[i], __ATOMIC_RELAXED);
+		float    d     = xy_density[i] * persistence + (uint32_t)(hits - xy_seen[i]);
+
+		xy_seen[i]    = hits;
+		xy_density[i] = d;
+		density_max   = MAX(density_max, d);
+		i++;
+	}
+
+	cairo_surface_flush(xy_surface);
+	memset(xy_pixels, 0, sizeof(xy_pixels));
+
+	if (density_max > 0) {
+		scale = 255 / log1pf(density_max);
+		i = 0;
+		while (i < 3) {
+			rgb[i] = color[i] * 255;
+			i++;
+		}
+
+		i = 0;
+		while (i < XY_BINS * XY_BINS) {
+			// Premultiplied ARGB
+			if (xy_density[i] >= 1./255) {
+				uint32_t a = log1pf(xy_density[i]) * scale;
+
+				xy_pixels[i] = a << 24 | (rgb[0] * a / 255) << 16 | (rgb[1] * a / 255) << 8 | (rgb[2] * a / 255);
+			}
+			i++;
+		}
+	}
+	cairo_surface_mark_dirty(xy_surface);
+
+	cairo_save(cr);
+	cairo_scale(cr, (double)width / XY_BINS, (double)height / XY_BINS);
+	cairo_set_source_surface(cr, xy_surface, 0, 0);
+	cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+	cairo_paint(cr);
+	cairo_restore(cr);
+}
@@ -0,0 +1,64 @@
+/*
+    voltlogger_oscilloscope
+    
+    Copyright (C) 2015 Dmitry Yu Okunev <dyokunev@ut.mephi.ru> 0x8E30679C
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VOLTLOGGER_XY_H
+#define __VOLTLOGGER_XY_H
+
+#include <stdint.h>
+#include <cairo.h>
+
+#include "history.h"
+
+/*
+ * XY (Lissajous) display of two channels from a density accumulator:
+ * xy_feed() is called once per ingested record (by a single thread) and
+ * only increments the hit counter of the (x, y) bin, no path is built.
+ * xy_draw() folds the hits appeared since the previous frame into a
+ * decaying density (the persistence) and maps it to brightness.
+ */
+
+/* XY_BINS x XY_BINS bins over the Y_BITS-bit values */
+#define XY_BITS		9
+#define XY_BINS		(1 << XY_BITS)
+
+#define XY_PERSISTENCE_DEFAULT	0.9
+
+typedef struct {
+	int    x;			/* channels			*/
+	int    y;
+	double persistence;		/* the density kept per frame	*/
+} xy_config_t;
+
+extern xy_config_t xy_config;
+extern char        xy_enabled;
+extern uint32_t    xy_hits[XY_BINS * XY_BINS];
+
+extern int  xy_parse(char *spec);
+extern void xy_draw(cairo_t *cr, int width, int height, const double color[3]);
+
+static inline void xy_feed(const history_t *p) {
+	uint32_t x = MIN(p->value[xy_config.x], (1 << Y_BITS) - 1) >> (Y_BITS - XY_BITS);
+	uint32_t y = MIN(p->value[xy_config.y], (1 << Y_BITS) - 1) >> (Y_BITS - XY_BITS);
+	uint32_t *hits = &xy_hits[(XY_BINS - 1 - y) * XY_BINS + x];
+
+	// The only writer; the store is atomic for xy_draw() reading concurrently
+	__atomic_store_n(hits, *hits + 1, __ATOMIC_RELAXED);
+}
+
+#endif